@@ -7,12 +7,14 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <learnopengl/asset_pack.h>
 
+// the file's contents from the asset pack or the mapped file, an empty string if it can't be read
 std::string readFileContents(std::string path) {
-    std::ifstream in(path);
-    std::stringstream buffer;
-    buffer << in.rdbuf();
-    return buffer.str();
+    AssetFile file(path);
+    if (!file.isOpen())
+        return std::string();
+    return std::string(reinterpret_cast<const char *>(file.data()), file.size());
 }
 
 
@@ -0,0 +1,338 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <learnopengl/mapped_file.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+// Single-file asset pack: every shader, texture, model and cubemap face in one file, memory-mapped once at
+// startup. Loaders get a pointer into the mapping instead of opening and reading the file, so a cold start
+// is one sequential read and a warm one is page cache hits without a syscall per asset.
+//
+// layout: AssetPackHeader, the entries sorted by path, the path strings, then the file contents.
+// Every blob starts on a 64-byte boundary and is followed by at least one zero byte, so text assets
+// (shaders) can be used as C strings straight from the mapping.
+
+const char ASSET_PACK_MAGIC[8] = {'R', 'G', 'P', 'A', 'C', 'K', '\0', '\0'};
+const uint32_t ASSET_PACK_VERSION = 1;
+const uint64_t ASSET_PACK_ALIGNMENT = 64;
+
+struct AssetPackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entryCount;
+    uint64_t stringTableSize;
+    uint64_t fileSize;
+};
+
+struct AssetPackEntry {
+    uint64_t dataOffset;
+    uint64_t size;
+    uint32_t pathOffset;    // into the string table, paths are relative to the directory of the pack
+    uint32_t pathLength;
+};
+
+// lexically normalized absolute path: relative paths are taken from the working directory,
+// "." and ".." components and repeated slashes are resolved without touching the file system
+inline string normalizeAssetPath(const string &path)
+{
+    // nothing here changes the working directory, ask for it once instead of on every lookup
+    static const string cwd = [] {
+        char buffer[PATH_MAX];
+        return getcwd(buffer, sizeof(buffer)) ? string(buffer) : string();
+    }();
+    string full = path;
+    if (full.empty() || full[0] != '/')
+        full = cwd + '/' + full;
+
+    vector<string> parts;
+    size_t start = 0;
+    while (start <= full.size())
+    {
+        size_t end = full.find('/', start);
+        if (end == string::npos)
+            end = full.size();
+        string part = full.substr(start, end - start);
+        if (part == "..")
+        {
+            if (!parts.empty())
+                parts.pop_back();
+        }
+        else if (!part.empty() && part != ".")
+            parts.push_back(part);
+        start = end + 1;
+    }
+
+    string result;
+    for (const string &part : parts)
+        result += '/' + part;
+    return result.empty() ? "/" : result;
+}
+
+class AssetPack
+{
+public:
+    // maps the pack, returns false if it's missing or malformed (and everything is read from loose files)
+    bool open(const string &path)
+    {
+        close();
+        if (!file.open(path))
+            return false;
+        const unsigned char *base = file.data();
+        if (file.size() < sizeof(AssetPackHeader))
+            return fail(path);
+        header = reinterpret_cast<const AssetPackHeader *>(base);
+        uint64_t tablesSize = sizeof(AssetPackHeader) + (uint64_t)header->entryCount * sizeof(AssetPackEntry);
+        if (memcmp(header->magic, ASSET_PACK_MAGIC, sizeof(ASSET_PACK_MAGIC)) != 0
+            || header->version != ASSET_PACK_VERSION || header->fileSize != file.size()
+            || tablesSize + header->stringTableSize > file.size())
+            return fail(path);
+        entries = reinterpret_cast<const AssetPackEntry *>(base + sizeof(AssetPackHeader));
+        strings = reinterpret_cast<const char *>(base + tablesSize);
+        for (uint32_t i = 0; i < header->entryCount; i++)
+        {
+            const AssetPackEntry &entry = entries[i];
+            if ((uint64_t)entry.pathOffset + entry.pathLength > header->stringTableSize
+                || entry.dataOffset + entry.size + 1 > file.size())
+                return fail(path);
+        }
+
+        // the whole pack is about to be read anyway, start pulling it in as one sequential read
+        file.willNeed();
+        root = normalizeAssetPath(path);
+        root = root.substr(0, root.find_last_of('/') + 1);
+        return true;
+    }
+
+    void close()
+    {
+        file.close();
+        header = nullptr;
+        entries = nullptr;
+        strings = nullptr;
+        root.clear();
+    }
+
+    bool isOpen() const { return header != nullptr; }
+
+    // looks the file up by its path (absolute, or relative to the working directory), data points into the
+    // mapping and stays valid while the pack is open. Safe to call from any thread once the pack is open.
+    bool find(const string &path, const unsigned char *&data, size_t &size) const
+    {
+        if (!isOpen())
+            return false;
+        string key = normalizeAssetPath(path);
+        if (key.compare(0, root.size(), root) != 0)
+            return false;
+        if (hasOverrides.load(memory_order_acquire))
+        {
+            lock_guard<mutex> lock(overrideMutex);
+            if (overridden.count(key))
+                return false;
+        }
+        key.erase(0, root.size());
+
+        const AssetPackEntry *end = entries + header->entryCount;
+        const AssetPackEntry *it = lower_bound(entries, end, key, [this](const AssetPackEntry &entry, const string &key) {
+            return key.compare(0, string::npos, strings + entry.pathOffset, entry.pathLength) > 0;
+        });
+        if (it == end || key.compare(0, string::npos, strings + it->pathOffset, it->pathLength) != 0)
+            return false;
+        data = file.data() + it->dataOffset;
+        size = it->size;
+        return true;
+    }
+
+    // the file changed on disk (see FileWatcher), from now on it's read from there instead of the pack
+    void overrideWithLooseFile(const string &path)
+    {
+        lock_guard<mutex> lock(overrideMutex);
+        overridden.insert(normalizeAssetPath(path));
+        hasOverrides.store(true, memory_order_release);
+    }
+
+    bool contains(const string &path) const
+    {
+        const unsigned char *data;
+        size_t size;
+        return find(path, data, size);
+    }
+
+private:
+    MappedFile file;
+    const AssetPackHeader *header = nullptr;
+    const AssetPackEntry *entries = nullptr;
+    const char *strings = nullptr;
+    string root;    // normalized directory of the pack, with the trailing slash
+    mutable mutex overrideMutex;
+    set<string> overridden;
+    atomic<bool> hasOverrides{false};
+
+    bool fail(const string &path)
+    {
+        cout << "WARNING::ASSET_PACK:: " << path << " is not a valid asset pack, using loose files" << endl;
+        close();
+        return false;
+    }
+};
+
+inline AssetPack &assetPack()
+{
+    static AssetPack pack;
+    return pack;
+}
+
+// the bytes of an asset, wherever they are: a view into the asset pack when the file is packed, a
+// mapping of the loose file otherwise. Same interface as MappedFile.
+class AssetFile
+{
+public:
+    AssetFile() {}
+
+    explicit AssetFile(const string &path)
+    {
+        open(path);
+    }
+
+    AssetFile(const AssetFile &) = delete;
+    AssetFile &operator=(const AssetFile &) = delete;
+
+    bool open(const string &path)
+    {
+        close();
+        if (assetPack().find(path, view, viewSize))
+            return true;
+        if (!file.open(path))
+            return false;
+        view = file.data();
+        viewSize = file.size();
+        return true;
+    }
+
+    void close()
+    {
+        file.close();
+        view = nullptr;
+        viewSize = 0;
+    }
+
+    bool isOpen() const { return view != nullptr; }
+    const unsigned char *data() const { return view; }
+    size_t size() const { return viewSize; }
+
+private:
+    MappedFile file;
+    const unsigned char *view = nullptr;
+    size_t viewSize = 0;
+};
+
+// writes a pack holding the given files, named by their paths relative to root (the directory the pack is
+// loaded from). Written to a temporary name and renamed into place, like the mesh cache.
+inline bool writeAssetPack(const string &packPath, const string &root, vector<string> paths)
+{
+    string rootPrefix = normalizeAssetPath(root);
+    if (rootPrefix.back() != '/')
+        rootPrefix += '/';
+
+    vector<string> names;
+    for (const string &path : paths)
+    {
+        string name = normalizeAssetPath(path);
+        if (name.compare(0, rootPrefix.size(), rootPrefix) != 0)
+        {
+            cout << "ERROR::ASSET_PACK:: " << path << " is outside of " << root << endl;
+            return false;
+        }
+        names.push_back(name.substr(rootPrefix.size()));
+    }
+    vector<size_t> order(paths.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&names](size_t a, size_t b) { return names[a] < names[b]; });
+
+    vector<AssetPackEntry> entries;
+    vector<MappedFile> files;
+    string strings, previous;
+    for (size_t i : order)
+    {
+        // the same file listed twice
+        if (!entries.empty() && names[i] == previous)
+            continue;
+        previous = names[i];
+        MappedFile file(paths[i]);
+        if (!file.isOpen())
+        {
+            // empty files can't be mapped, everything else should be readable
+            ifstream check(paths[i]);
+            if (!check || check.peek() != EOF)
+            {
+                cout << "ERROR::ASSET_PACK:: failed to read " << paths[i] << endl;
+                return false;
+            }
+        }
+        AssetPackEntry entry = {};
+        entry.size = file.size();
+        entry.pathOffset = strings.size();
+        entry.pathLength = names[i].size();
+        strings += names[i];
+        entries.push_back(entry);
+        files.push_back(move(file));
+    }
+
+    // every blob gets a terminating zero, the padding up to the next blob provides it
+    uint64_t offset = sizeof(AssetPackHeader) + entries.size() * sizeof(AssetPackEntry) + strings.size();
+    for (AssetPackEntry &entry : entries)
+    {
+        entry.dataOffset = (offset + ASSET_PACK_ALIGNMENT - 1) & ~(ASSET_PACK_ALIGNMENT - 1);
+        offset = entry.dataOffset + entry.size + 1;
+    }
+
+    AssetPackHeader header = {};
+    memcpy(header.magic, ASSET_PACK_MAGIC, sizeof(ASSET_PACK_MAGIC));
+    header.version = ASSET_PACK_VERSION;
+    header.entryCount = entries.size();
+    header.stringTableSize = strings.size();
+    header.fileSize = offset;
+
+    string tmpPath = packPath + ".tmp";
+    {
+        ofstream out(tmpPath, ios::binary | ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(AssetPackEntry));
+        out.write(strings.data(), strings.size());
+
+        static const char padding[ASSET_PACK_ALIGNMENT + 1] = {};
+        uint64_t written = sizeof(AssetPackHeader) + entries.size() * sizeof(AssetPackEntry) + strings.size();
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            out.write(padding, entries[i].dataOffset - written);
+            out.write(reinterpret_cast<const char *>(files[i].data()), entries[i].size);
+            written = entries[i].dataOffset + entries[i].size;
+        }
+        out.write(padding, offset - written);
+        if (!out)
+        {
+            out.close();
+            remove(tmpPath.c_str());
+            return false;
+        }
+    }
+    return rename(tmpPath.c_str(), packPath.c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,357 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include <learnopengl/asset_pack.h>
+#include <learnopengl/thread_pool.h>
+
+#include <linux/io_uring.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+using namespace std;
+
+// older headers don't know the io_uring syscalls yet, the numbers are the same on every architecture
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+// what an asynchronous read produced: a view into the asset pack, or the file read into a buffer of its own.
+// data is null if the file couldn't be read.
+struct FileContents {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    vector<unsigned char> buffer;
+};
+
+typedef function<void(shared_ptr<FileContents>)> ReadCallback;
+
+// Asynchronous whole-file reads. Loaders submit every read up front and get a callback as each one completes,
+// so waiting on the disk overlaps with decoding what has already arrived instead of alternating with it.
+// Reads go through an io_uring (driven with the raw syscalls, no liburing needed) with one thread reaping the
+// completions; where io_uring isn't available (old kernels, seccomp) a few threads do blocking preads instead.
+// Files found in the asset pack complete right away without any I/O.
+// Callbacks run on the reaping thread (or the caller's, for packed files): hand real work on to a pool.
+class AsyncReader
+{
+public:
+    explicit AsyncReader(unsigned int queueDepth = 64) : queueDepth(queueDepth)
+    {
+        if (!setupRing())
+            cout << "WARNING::ASYNC_READER:: io_uring not available, reading with pread on worker threads" << endl;
+    }
+
+    ~AsyncReader()
+    {
+        if (ringFd >= 0)
+        {
+            // the reaper finishes the reads in flight, then exits on this no-op
+            {
+                lock_guard<mutex> lock(submitMutex);
+                io_uring_sqe *sqe = nextSqe();
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = 0;
+                submitSqe();
+            }
+            reaper.join();
+            munmap(sqes, sqeMappingSize);
+            if (cqMapping != sqMapping)
+                munmap(cqMapping, cqMappingSize);
+            munmap(sqMapping, sqMappingSize);
+            ::close(ringFd);
+        }
+        // the fallback pool drains its queue when it goes
+        fallback.reset();
+    }
+
+    AsyncReader(const AsyncReader &) = delete;
+    AsyncReader &operator=(const AsyncReader &) = delete;
+
+    // reads the whole file and calls done with its contents, from any thread
+    void read(const string &path, ReadCallback done)
+    {
+        shared_ptr<FileContents> contents = make_shared<FileContents>();
+        if (assetPack().find(path, contents->data, contents->size))
+        {
+            done(contents);
+            return;
+        }
+
+        Request *request = new Request();
+        request->contents = contents;
+        request->done = move(done);
+        request->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (request->fd < 0 || fstat(request->fd, &info) != 0)
+        {
+            finish(request, false);
+            return;
+        }
+        contents->buffer.resize((size_t)info.st_size);
+
+        lock_guard<mutex> lock(submitMutex);
+        if (ringFd < 0)
+            readBlocking(request);
+        else if (inFlight < queueDepth)
+        {
+            inFlight++;
+            submitRead(request);
+        }
+        else
+            waiting.push_back(request);
+    }
+
+    bool usingIoUring() const { return ringFd >= 0; }
+
+private:
+    struct Request {
+        int fd = -1;
+        size_t offset = 0;
+        shared_ptr<FileContents> contents;
+        ReadCallback done;
+    };
+
+    const unsigned int queueDepth;
+    mutex submitMutex;
+    deque<Request *> waiting;       // submitted while queueDepth reads were in flight
+    unsigned int inFlight = 0;
+    unique_ptr<ThreadPool> fallback;
+
+    int ringFd = -1;
+    void *sqMapping = nullptr, *cqMapping = nullptr;
+    size_t sqMappingSize = 0, cqMappingSize = 0, sqeMappingSize = 0;
+    unsigned int *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned int *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    thread reaper;
+
+    bool setupRing()
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = (int)syscall(__NR_io_uring_setup, queueDepth, &params);
+        if (fd < 0)
+            return false;
+
+        sqMappingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        cqMappingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMapping)
+            sqMappingSize = cqMappingSize = max(sqMappingSize, cqMappingSize);
+        sqMapping = mmap(nullptr, sqMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqMapping == MAP_FAILED)
+        {
+            ::close(fd);
+            return false;
+        }
+        cqMapping = singleMapping ? sqMapping
+                                  : mmap(nullptr, cqMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqeMappingSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqeMapping = cqMapping == MAP_FAILED ? MAP_FAILED
+                           : mmap(nullptr, sqeMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqeMapping == MAP_FAILED)
+        {
+            if (cqMapping != MAP_FAILED && cqMapping != sqMapping)
+                munmap(cqMapping, cqMappingSize);
+            munmap(sqMapping, sqMappingSize);
+            ::close(fd);
+            return false;
+        }
+
+        unsigned char *sq = static_cast<unsigned char *>(sqMapping);
+        unsigned char *cq = static_cast<unsigned char *>(cqMapping);
+        sqTail = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned int *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned int *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        sqes = static_cast<io_uring_sqe *>(sqeMapping);
+        ringFd = fd;
+        reaper = thread([this] { reapLoop(); });
+        return true;
+    }
+
+    // submitMutex held. Every SQE is submitted as soon as it's filled in, so the next slot is always free.
+    io_uring_sqe *nextSqe()
+    {
+        io_uring_sqe *sqe = &sqes[*sqTail & *sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    void submitSqe()
+    {
+        unsigned int tail = *sqTail;
+        sqArray[tail & *sqMask] = tail & *sqMask;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        while (syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+
+    // submitMutex held, the read is already counted in inFlight
+    void submitRead(Request *request)
+    {
+        size_t remaining = request->contents->buffer.size() - request->offset;
+        if (remaining == 0)
+        {
+            // nothing to read, but it still completes through the reaper like every other read
+            io_uring_sqe *sqe = nextSqe();
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = reinterpret_cast<uint64_t>(request);
+            submitSqe();
+            return;
+        }
+        io_uring_sqe *sqe = nextSqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = request->fd;
+        sqe->off = request->offset;
+        sqe->addr = reinterpret_cast<uint64_t>(request->contents->buffer.data() + request->offset);
+        sqe->len = (unsigned int)min<size_t>(remaining, 1u << 30);
+        sqe->user_data = reinterpret_cast<uint64_t>(request);
+        submitSqe();
+    }
+
+    void reapLoop()
+    {
+        bool stopRequested = false;
+        for (;;)
+        {
+            if (stopRequested && idle())
+                return;
+            unsigned int head = *cqHead;
+            if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            {
+                syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                continue;
+            }
+            io_uring_cqe cqe = cqes[head & *cqMask];
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+            if (cqe.user_data == 0)
+            {
+                stopRequested = true;
+                continue;
+            }
+            Request *request = reinterpret_cast<Request *>(cqe.user_data);
+            FileContents &contents = *request->contents;
+            if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP)
+            {
+                // a kernel with io_uring but without IORING_OP_READ (before 5.6)
+                retire();
+                lock_guard<mutex> lock(submitMutex);
+                readBlocking(request);
+                continue;
+            }
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN || (cqe.res > 0 && request->offset + cqe.res < contents.buffer.size()))
+            {
+                // interrupted or a short read, go on from where it stopped
+                if (cqe.res > 0)
+                    request->offset += cqe.res;
+                lock_guard<mutex> lock(submitMutex);
+                submitRead(request);
+                continue;
+            }
+            // done, failed, or the file got shorter since it was opened
+            if (cqe.res >= 0)
+                contents.buffer.resize(request->offset + cqe.res);
+            retire();
+            finish(request, cqe.res >= 0);
+        }
+    }
+
+    // a read left the ring, let the next waiting one in
+    void retire()
+    {
+        lock_guard<mutex> lock(submitMutex);
+        inFlight--;
+        if (!waiting.empty())
+        {
+            Request *next = waiting.front();
+            waiting.pop_front();
+            inFlight++;
+            submitRead(next);
+        }
+    }
+
+    bool idle()
+    {
+        lock_guard<mutex> lock(submitMutex);
+        return inFlight == 0 && waiting.empty();
+    }
+
+    // submitMutex held
+    void readBlocking(Request *request)
+    {
+        if (!fallback)
+            fallback.reset(new ThreadPool(4));
+        fallback->enqueue([this, request] {
+            vector<unsigned char> &buffer = request->contents->buffer;
+            while (request->offset < buffer.size())
+            {
+                ssize_t count = pread(request->fd, buffer.data() + request->offset, buffer.size() - request->offset, request->offset);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count < 0)
+                {
+                    finish(request, false);
+                    return;
+                }
+                if (count == 0)
+                {
+                    buffer.resize(request->offset);
+                    break;
+                }
+                request->offset += count;
+            }
+            finish(request, true);
+        });
+    }
+
+    static void finish(Request *request, bool ok)
+    {
+        if (request->fd >= 0)
+            ::close(request->fd);
+        FileContents &contents = *request->contents;
+        if (ok)
+        {
+            // a pointer for empty files too, data being null means failure
+            static const unsigned char empty = 0;
+            contents.data = contents.buffer.empty() ? &empty : contents.buffer.data();
+            contents.size = contents.buffer.size();
+        }
+        else
+            vector<unsigned char>().swap(contents.buffer);
+        request->done(request->contents);
+        delete request;
+    }
+};
+
+inline AsyncReader &asyncReader()
+{
+    static AsyncReader reader;
+    return reader;
+}
+
+#endif
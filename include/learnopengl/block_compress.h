@@ -0,0 +1,169 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Small BC1/BC3 (DXT1/DXT5) encoder for the offline texture baker. Endpoints come from a range fit along the
+// principal axis of each 4x4 block (good enough for photos and flags, nowhere near a full cluster fit).
+
+inline uint16_t packRgb565(const int color[3])
+{
+    return (uint16_t)(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+}
+
+inline void unpackRgb565(uint16_t packed, int color[3])
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// encodes the color of a 4x4 RGBA block (64 bytes) into 8 bytes, always in 4-color mode
+inline void compressColorBlock(const unsigned char *rgba, unsigned char *out)
+{
+    // principal axis from the covariance of the block, via a few power iterations
+    float mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+            mean[c] += rgba[i * 4 + c] / 16.0f;
+    float cov[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        float d[3] = {rgba[i * 4] - mean[0], rgba[i * 4 + 1] - mean[1], rgba[i * 4 + 2] - mean[2]};
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+    float axis[3] = {1, 1, 1};
+    for (int iteration = 0; iteration < 4; iteration++)
+    {
+        float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                         cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                         cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+        float length = max(fabsf(next[0]), max(fabsf(next[1]), fabsf(next[2])));
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+            axis[c] = next[c] / length;
+    }
+
+    // the extreme pixels along the axis become the endpoints
+    int minIndex = 0, maxIndex = 0;
+    float minDot = 1e30f, maxDot = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float dot = rgba[i * 4] * axis[0] + rgba[i * 4 + 1] * axis[1] + rgba[i * 4 + 2] * axis[2];
+        if (dot < minDot) { minDot = dot; minIndex = i; }
+        if (dot > maxDot) { maxDot = dot; maxIndex = i; }
+    }
+    int maxColor[3] = {rgba[maxIndex * 4], rgba[maxIndex * 4 + 1], rgba[maxIndex * 4 + 2]};
+    int minColor[3] = {rgba[minIndex * 4], rgba[minIndex * 4 + 1], rgba[minIndex * 4 + 2]};
+    uint16_t color0 = packRgb565(maxColor), color1 = packRgb565(minColor);
+    if (color0 < color1)
+        swap(color0, color1);
+
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+        int palette[4][3];
+        unpackRgb565(color0, palette[0]);
+        unpackRgb565(color1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 4; p++)
+            {
+                int dr = rgba[i * 4] - palette[p][0], dg = rgba[i * 4 + 1] - palette[p][1], db = rgba[i * 4 + 2] - palette[p][2];
+                int error = dr * dr + dg * dg + db * db;
+                if (error < bestError) { bestError = error; best = p; }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+    // with color0 == color1 every index stays 0, which is color0 in either mode
+
+    out[0] = color0 & 0xFF; out[1] = color0 >> 8;
+    out[2] = color1 & 0xFF; out[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++)
+        out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// encodes the alpha of a 4x4 RGBA block into the 8-byte BC3 alpha block, 8-value interpolation mode
+inline void compressAlphaBlock(const unsigned char *rgba, unsigned char *out)
+{
+    int alpha0 = 0, alpha1 = 255;
+    for (int i = 0; i < 16; i++)
+    {
+        alpha0 = max(alpha0, (int)rgba[i * 4 + 3]);
+        alpha1 = min(alpha1, (int)rgba[i * 4 + 3]);
+    }
+    out[0] = alpha0;
+    out[1] = alpha1;
+
+    uint64_t indices = 0;
+    if (alpha0 != alpha1)
+    {
+        int palette[8] = {alpha0, alpha1};
+        for (int p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 8; p++)
+            {
+                int error = abs((int)rgba[i * 4 + 3] - palette[p]);
+                if (error < bestError) { bestError = error; best = p; }
+            }
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// compresses an RGBA8 image into BC1 (8 bytes per block) or BC3 (16 bytes per block).
+// Blocks hanging over the edge repeat the last row/column.
+inline vector<unsigned char> compressImage(const unsigned char *rgba, int width, int height, bool withAlpha)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    const int blockSize = withAlpha ? 16 : 8;
+    vector<unsigned char> out((size_t)blocksX * blocksY * blockSize);
+    unsigned char block[64];
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            for (int y = 0; y < 4; y++)
+            {
+                int sy = min(by * 4 + y, height - 1);
+                for (int x = 0; x < 4; x++)
+                {
+                    int sx = min(bx * 4 + x, width - 1);
+                    memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+                }
+            }
+            unsigned char *dst = &out[((size_t)by * blocksX + bx) * blockSize];
+            if (withAlpha)
+            {
+                compressAlphaBlock(block, dst);
+                compressColorBlock(block, dst + 8);
+            }
+            else
+                compressColorBlock(block, dst);
+        }
+    }
+    return out;
+}
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/frustum.h>
+#include <learnopengl/thread_pool.h>
+#include <learnopengl/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
+#include <vector>
+using namespace std;
+
+// centroid bins per axis the SAH builder evaluates splits between
+const unsigned int BVH_BINS = 16;
+// leaves hold at most this many items unless their centroids can't be told apart
+const unsigned int BVH_MAX_LEAF_ITEMS = 4;
+// subtrees with at least this many items are built on the workerPool(), smaller ones aren't worth the handoff
+const unsigned int BVH_PARALLEL_ITEMS = 4096;
+
+struct BvhNode {
+    glm::vec3 boundsMin, boundsMax;
+    unsigned int first;     // a leaf's first item in Bvh::items, an inner node's left child (the right one follows)
+    unsigned int count;     // items in a leaf, 0 for inner nodes
+};
+
+// Bounding volume hierarchy over world space object bounds, for culling and picking in logarithmic time.
+// Built top down with a binned surface area heuristic: each node's items are sorted into BVH_BINS bins
+// by centroid on every axis and split where the expected traversal cost is lowest; big subtrees are built in
+// parallel. Objects that move are refit with update(), which only walks from their leaf up as long as the
+// bounds change. Refitting doesn't move items between nodes, rebuild once things have moved far.
+// Items are the indices of the bounds build() was given. Queries share scratch space, one at a time.
+class Bvh
+{
+public:
+    void build(const vector<Aabb> &bounds)
+    {
+        TRACE_SCOPE("BVH build");
+        itemBounds = bounds;
+        const unsigned int count = bounds.size();
+        nodes.clear();
+        if (count == 0)
+            return;
+
+        // a binary tree with a leaf per item at worst, nodes are handed out from the front by nodeCount
+        nodes.resize(2 * count - 1);
+        parents.assign(nodes.size(), 0);
+        leaves.assign(count, 0);
+        items.resize(count);
+        iota(items.begin(), items.end(), 0u);
+        centroids.resize(count);
+        for (unsigned int i = 0; i < count; i++)
+            centroids[i] = (bounds[i].boundsMin + bounds[i].boundsMax) * 0.5f;
+
+        nodeCount = 1;
+        pendingTasks = 0;
+        subdivide(0, 0, count);
+        {
+            unique_lock<mutex> lock(buildMutex);
+            buildDone.wait(lock, [this] { return pendingTasks == 0; });
+        }
+        nodes.resize(nodeCount);
+    }
+
+    // refits the tree to an item's new bounds
+    void update(unsigned int item, const Aabb &bounds)
+    {
+        itemBounds[item] = bounds;
+        for (unsigned int node = leaves[item];; node = parents[node])
+        {
+            BvhNode &n = nodes[node];
+            Aabb box = n.count ? itemsBounds(n.first, n.count) : unite(nodes[n.first], nodes[n.first + 1]);
+            if (box.boundsMin == n.boundsMin && box.boundsMax == n.boundsMax)
+                return;
+            n.boundsMin = box.boundsMin;
+            n.boundsMax = box.boundsMax;
+            if (node == 0)
+                return;
+        }
+    }
+
+    const Aabb &bounds(unsigned int item) const { return itemBounds[item]; }
+    size_t size() const { return itemBounds.size(); }
+
+    // writes the items whose bounds intersect the frustum to visible (replacing what was there), returns
+    // how many there are. A node outside the frustum drops its whole subtree.
+    size_t queryFrustum(const Frustum &frustum, vector<unsigned int> &visible)
+    {
+        visible.clear();
+        if (nodes.empty())
+            return 0;
+        stack.assign(1, 0);
+        while (!stack.empty())
+        {
+            const BvhNode &node = nodes[stack.back()];
+            stack.pop_back();
+            if (!frustum.intersects(Aabb{node.boundsMin, node.boundsMax}))
+                continue;
+            if (node.count == 0)
+            {
+                stack.push_back(node.first);
+                stack.push_back(node.first + 1);
+                continue;
+            }
+            for (unsigned int i = node.first; i < node.first + node.count; i++)
+                if (node.count == 1 || frustum.intersects(itemBounds[items[i]]))
+                    visible.push_back(items[i]);
+        }
+        return visible.size();
+    }
+
+    // the nearest item whose bounds the ray hits within distance (updated to the hit) and that accept(item)
+    // takes, -1 if there is none. Nearer children are visited first, so most far subtrees are never opened.
+    template <typename Accept>
+    int raycast(const glm::vec3 &origin, const glm::vec3 &direction, float &distance, Accept accept)
+    {
+        if (nodes.empty())
+            return -1;
+        glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        int hit = -1;
+        stack.assign(1, 0);
+        while (!stack.empty())
+        {
+            const BvhNode &node = nodes[stack.back()];
+            stack.pop_back();
+            float entry;
+            if (!intersectRay(origin, inverse, node.boundsMin, node.boundsMax, distance, entry))
+                continue;
+            if (node.count == 0)
+            {
+                float left, right;
+                const BvhNode &a = nodes[node.first], &b = nodes[node.first + 1];
+                bool hitLeft = intersectRay(origin, inverse, a.boundsMin, a.boundsMax, distance, left);
+                bool hitRight = intersectRay(origin, inverse, b.boundsMin, b.boundsMax, distance, right);
+                // the nearer one goes on top
+                if (hitLeft && hitRight && left > right)
+                {
+                    stack.push_back(node.first);
+                    stack.push_back(node.first + 1);
+                }
+                else
+                {
+                    if (hitRight)
+                        stack.push_back(node.first + 1);
+                    if (hitLeft)
+                        stack.push_back(node.first);
+                }
+                continue;
+            }
+            for (unsigned int i = node.first; i < node.first + node.count; i++)
+            {
+                const Aabb &box = itemBounds[items[i]];
+                if (intersectRay(origin, inverse, box.boundsMin, box.boundsMax, distance, entry) && accept(items[i]))
+                {
+                    distance = entry;
+                    hit = items[i];
+                }
+            }
+        }
+        return hit;
+    }
+
+    int raycast(const glm::vec3 &origin, const glm::vec3 &direction, float &distance)
+    {
+        return raycast(origin, direction, distance, [](unsigned int) { return true; });
+    }
+
+private:
+    vector<Aabb> itemBounds;
+    vector<glm::vec3> centroids;
+    vector<unsigned int> items;         // item indices, every leaf's are contiguous
+    vector<BvhNode> nodes;              // nodes[0] is the root
+    vector<unsigned int> parents;
+    vector<unsigned int> leaves;        // the leaf holding each item
+    vector<unsigned int> stack;         // traversal scratch space
+
+    // build state shared with the workers
+    atomic<unsigned int> nodeCount{0};
+    mutex buildMutex;
+    condition_variable buildDone;
+    unsigned int pendingTasks = 0;
+
+    static float area(const Aabb &box)
+    {
+        glm::vec3 d = box.boundsMax - box.boundsMin;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static Aabb unite(const BvhNode &a, const BvhNode &b)
+    {
+        return Aabb{glm::min(a.boundsMin, b.boundsMin), glm::max(a.boundsMax, b.boundsMax)};
+    }
+
+    Aabb itemsBounds(unsigned int first, unsigned int count) const
+    {
+        Aabb box{glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            box.boundsMin = glm::min(box.boundsMin, itemBounds[items[i]].boundsMin);
+            box.boundsMax = glm::max(box.boundsMax, itemBounds[items[i]].boundsMax);
+        }
+        return box;
+    }
+
+    // slab test, entry is where the ray enters the box (0 when it starts inside)
+    static bool intersectRay(const glm::vec3 &origin, const glm::vec3 &inverse, const glm::vec3 &boundsMin,
+                             const glm::vec3 &boundsMax, float maxDistance, float &entry)
+    {
+        float tNear = 0.0f, tFar = maxDistance;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t0 = (boundsMin[axis] - origin[axis]) * inverse[axis];
+            float t1 = (boundsMax[axis] - origin[axis]) * inverse[axis];
+            tNear = max(tNear, min(t0, t1));
+            tFar = min(tFar, max(t0, t1));
+        }
+        entry = tNear;
+        return tNear <= tFar;
+    }
+
+    void makeLeaf(unsigned int node, unsigned int first, unsigned int count)
+    {
+        nodes[node].first = first;
+        nodes[node].count = count;
+        for (unsigned int i = first; i < first + count; i++)
+            leaves[items[i]] = node;
+    }
+
+    // builds the subtree of items[first..first + count) into nodes[node]
+    void subdivide(unsigned int node, unsigned int first, unsigned int count)
+    {
+        Aabb box = itemsBounds(first, count);
+        nodes[node].boundsMin = box.boundsMin;
+        nodes[node].boundsMax = box.boundsMax;
+        if (count <= 1)
+        {
+            makeLeaf(node, first, count);
+            return;
+        }
+
+        glm::vec3 centroidMin = centroids[items[first]], centroidMax = centroidMin;
+        for (unsigned int i = first + 1; i < first + count; i++)
+        {
+            centroidMin = glm::min(centroidMin, centroids[items[i]]);
+            centroidMax = glm::max(centroidMax, centroids[items[i]]);
+        }
+
+        // the cheapest split over all axes: the cost of a side is its surface area times its item count
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        unsigned int bestSplit = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+                continue;
+            Aabb bins[BVH_BINS];
+            unsigned int binCounts[BVH_BINS] = {};
+            for (Aabb &bin : bins)
+                bin = Aabb{glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+            float scale = BVH_BINS / extent;
+            for (unsigned int i = first; i < first + count; i++)
+            {
+                unsigned int b = min(BVH_BINS - 1, (unsigned int)((centroids[items[i]][axis] - centroidMin[axis]) * scale));
+                binCounts[b]++;
+                bins[b].boundsMin = glm::min(bins[b].boundsMin, itemBounds[items[i]].boundsMin);
+                bins[b].boundsMax = glm::max(bins[b].boundsMax, itemBounds[items[i]].boundsMax);
+            }
+
+            // sweep from the right for the right side's areas, then from the left evaluating every split
+            float rightArea[BVH_BINS];
+            unsigned int rightCount[BVH_BINS];
+            Aabb right = bins[BVH_BINS - 1];
+            unsigned int itemsRight = 0;
+            for (unsigned int b = BVH_BINS - 1; b > 0; b--)
+            {
+                right.boundsMin = glm::min(right.boundsMin, bins[b].boundsMin);
+                right.boundsMax = glm::max(right.boundsMax, bins[b].boundsMax);
+                itemsRight += binCounts[b];
+                rightArea[b] = itemsRight ? area(right) : 0.0f;
+                rightCount[b] = itemsRight;
+            }
+            Aabb left = bins[0];
+            unsigned int itemsLeft = 0;
+            for (unsigned int split = 1; split < BVH_BINS; split++)
+            {
+                left.boundsMin = glm::min(left.boundsMin, bins[split - 1].boundsMin);
+                left.boundsMax = glm::max(left.boundsMax, bins[split - 1].boundsMax);
+                itemsLeft += binCounts[split - 1];
+                if (itemsLeft == 0 || rightCount[split] == 0)
+                    continue;
+                float cost = itemsLeft * area(left) + rightCount[split] * rightArea[split];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        // all centroids in one spot, or a small node that a split wouldn't make cheaper to traverse
+        if (bestAxis < 0 || (count <= BVH_MAX_LEAF_ITEMS && bestCost >= count * area(box)))
+        {
+            makeLeaf(node, first, count);
+            return;
+        }
+
+        float scale = BVH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        float axisMin = centroidMin[bestAxis];
+        unsigned int *middle = partition(&items[first], &items[first] + count, [&](unsigned int item) {
+            return min(BVH_BINS - 1, (unsigned int)((centroids[item][bestAxis] - axisMin) * scale)) < bestSplit;
+        });
+        unsigned int leftCount = middle - &items[first];
+
+        unsigned int left = nodeCount.fetch_add(2);
+        nodes[node].first = left;
+        nodes[node].count = 0;
+        parents[left] = parents[left + 1] = node;
+
+        if (count >= BVH_PARALLEL_ITEMS)
+        {
+            {
+                lock_guard<mutex> lock(buildMutex);
+                pendingTasks++;
+            }
+            workerPool().enqueue([this, left, first, leftCount] {
+                subdivide(left, first, leftCount);
+                lock_guard<mutex> lock(buildMutex);
+                if (--pendingTasks == 0)
+                    buildDone.notify_all();
+            });
+        }
+        else
+            subdivide(left, first, leftCount);
+        subdivide(left + 1, first + leftCount, count - leftCount);
+    }
+};
+
+#endif
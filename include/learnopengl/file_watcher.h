@@ -0,0 +1,118 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <learnopengl/asset_pack.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+using namespace std;
+
+// inotify based watcher for hot reloading assets. Files are watched through their directories, so editors
+// that save by writing a new file and renaming it over the old one are caught as well as plain writes.
+// Changes are collected without blocking in poll(), once a frame on the GL thread, and every callback
+// registered for a changed file runs there. A changed file is read from disk from then on, even if the
+// asset pack has a (now stale) copy of it.
+// watch() does nothing until start() has been called, so loaders can register their files unconditionally.
+class FileWatcher
+{
+public:
+    ~FileWatcher()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool start()
+    {
+        if (fd >= 0)
+            return true;
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+        {
+            std::cout << "WARNING::FILE_WATCHER:: inotify not available, hot reload is off" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool running() const { return fd >= 0; }
+
+    // onChange runs from poll() whenever the file is written or replaced; the file doesn't have to exist yet
+    void watch(const string &path, function<void()> onChange)
+    {
+        if (fd < 0)
+            return;
+        string file = normalizeAssetPath(path);
+        string directory = file.substr(0, max<size_t>(1, file.find_last_of('/')));
+        if (!watchedDirectories.count(directory))
+        {
+            int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd < 0)
+            {
+                std::cout << "WARNING::FILE_WATCHER:: can't watch " << directory << std::endl;
+                return;
+            }
+            watchedDirectories.insert(directory);
+            directories[wd] = directory;
+        }
+        callbacks[file].push_back(move(onChange));
+    }
+
+    // GL thread, once per frame: runs the callbacks of the files that changed since the last call
+    void poll()
+    {
+        if (fd < 0)
+            return;
+        set<string> changed;
+        alignas(inotify_event) char buffer[4096];
+        for (;;)
+        {
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+            for (ssize_t offset = 0; offset < length;)
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                auto directory = directories.find(event->wd);
+                if (event->len == 0 || directory == directories.end())
+                    continue;
+                string file = directory->second + '/' + event->name;
+                if (callbacks.count(file))
+                    changed.insert(file);
+            }
+        }
+
+        for (const string &file : changed)
+        {
+            std::cout << "FILE_WATCHER:: reloading " << file << std::endl;
+            assetPack().overrideWithLooseFile(file);
+            // a copy, callbacks may register new watches
+            vector<function<void()>> fileCallbacks = callbacks[file];
+            for (function<void()> &callback : fileCallbacks)
+                callback();
+        }
+    }
+
+private:
+    int fd = -1;
+    set<string> watchedDirectories;
+    unordered_map<int, string> directories;                     // watch descriptor -> directory
+    unordered_map<string, vector<function<void()>>> callbacks;  // normalized path -> callbacks
+};
+
+inline FileWatcher &fileWatcher()
+{
+    static FileWatcher watcher;
+    return watcher;
+}
+
+#endif
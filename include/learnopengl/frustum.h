@@ -0,0 +1,201 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+// an axis aligned bounding box
+struct Aabb {
+    glm::vec3 boundsMin, boundsMax;
+};
+
+// the six planes of a view frustum, normalized, pointing inwards: a point p is inside when
+// dot(plane.xyz, p) + plane.w >= 0 for all of them
+struct Frustum {
+    glm::vec4 planes[6];
+
+    Frustum() = default;
+
+    // extracted from a projection * view (* model) matrix (Gribb & Hartmann), in the space that matrix
+    // transforms from
+    explicit Frustum(const glm::mat4 &m)
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        planes[0] = row3 + row0;    // left
+        planes[1] = row3 - row0;    // right
+        planes[2] = row3 + row1;    // bottom
+        planes[3] = row3 - row1;    // top
+        planes[4] = row3 + row2;    // near
+        planes[5] = row3 - row2;    // far
+        for (glm::vec4 &plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    bool intersects(const glm::vec3 &center, float radius) const
+    {
+        for (const glm::vec4 &plane : planes)
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        return true;
+    }
+
+    // tests the corner of the box farthest along each plane normal
+    bool intersects(const Aabb &box) const
+    {
+        for (const glm::vec4 &plane : planes)
+        {
+            glm::vec3 corner(plane.x >= 0.0f ? box.boundsMax.x : box.boundsMin.x,
+                             plane.y >= 0.0f ? box.boundsMax.y : box.boundsMin.y,
+                             plane.z >= 0.0f ? box.boundsMax.z : box.boundsMin.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+// the AABB of count vertices whose positions are the first three floats of every stride floats, like the
+// vertex arrays in main()
+inline void boundsOf(const float *vertices, size_t count, size_t stride, glm::vec3 &boundsMin, glm::vec3 &boundsMax)
+{
+    boundsMin = boundsMax = count > 0 ? glm::vec3(vertices[0], vertices[1], vertices[2]) : glm::vec3(0.0f);
+    for (size_t i = 1; i < count; i++)
+    {
+        glm::vec3 position(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+        boundsMin = glm::min(boundsMin, position);
+        boundsMax = glm::max(boundsMax, position);
+    }
+}
+
+// the world space AABB around an object space one (Arvo): every axis of the result takes the smaller and the
+// larger of each matrix entry times the box's extremes
+inline Aabb transformBounds(const glm::mat4 &model, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    Aabb box;
+    box.boundsMin = box.boundsMax = glm::vec3(model[3]);
+    for (int column = 0; column < 3; column++)
+        for (int row = 0; row < 3; row++)
+        {
+            float a = model[column][row] * boundsMin[column];
+            float b = model[column][row] * boundsMax[column];
+            box.boundsMin[row] += min(a, b);
+            box.boundsMax[row] += max(a, b);
+        }
+    return box;
+}
+
+// a bounding sphere moved into world space: the center is transformed, the radius grows with the
+// largest axis scale
+inline void transformSphere(const glm::mat4 &model, const glm::vec3 &center, float radius, glm::vec3 &worldCenter,
+                            float &worldRadius)
+{
+    worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+    float scale = max(glm::length(glm::vec3(model[0])), max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    worldRadius = radius * scale;
+}
+
+// Bounding spheres kept as separate arrays per component (structure of arrays), so the culling kernel loads
+// 4 (SSE) or 8 (AVX) of them per register and tests them against a plane at once.
+class SphereSet
+{
+public:
+    vector<float> x, y, z, radius;
+
+    size_t size() const { return x.size(); }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+        radius.clear();
+    }
+
+    void add(const glm::vec3 &center, float r)
+    {
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        radius.push_back(r);
+    }
+
+    void add(const glm::mat4 &model, const glm::vec3 &center, float r)
+    {
+        glm::vec3 worldCenter;
+        float worldRadius;
+        transformSphere(model, center, r, worldCenter, worldRadius);
+        add(worldCenter, worldRadius);
+    }
+};
+
+// writes the indices of the spheres that intersect the frustum to visible (replacing what was there), in
+// order, and returns how many there are. AVX or SSE depending on what the build targets, scalar otherwise
+// and for the spheres left over after the last full register.
+inline size_t cullSpheres(const Frustum &frustum, const SphereSet &spheres, vector<unsigned int> &visible)
+{
+    visible.clear();
+    const size_t count = spheres.size();
+    size_t i = 0;
+
+#if defined(__AVX__)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&spheres.x[i]);
+        __m256 y = _mm256_loadu_ps(&spheres.y[i]);
+        __m256 z = _mm256_loadu_ps(&spheres.z[i]);
+        __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&spheres.radius[i]));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)),
+                                                          _mm256_mul_ps(y, _mm256_set1_ps(plane.y))),
+                                            _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(plane.z)),
+                                                          _mm256_set1_ps(plane.w)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (unsigned int lane = 0; mask; lane++, mask >>= 1)
+            if (mask & 1)
+                visible.push_back(i + lane);
+    }
+#elif defined(__SSE__) || defined(_M_X64)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&spheres.x[i]);
+        __m128 y = _mm_loadu_ps(&spheres.y[i]);
+        __m128 z = _mm_loadu_ps(&spheres.z[i]);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+        __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());    // all ones
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (unsigned int lane = 0; mask; lane++, mask >>= 1)
+            if (mask & 1)
+                visible.push_back(i + lane);
+    }
+#endif
+
+    for (; i < count; i++)
+        if (frustum.intersects(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i]))
+            visible.push_back(i);
+    return visible.size();
+}
+
+#endif
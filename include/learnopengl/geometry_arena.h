@@ -0,0 +1,125 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+using namespace std;
+
+// where an allocation ended up: its block (and that block's buffers), the base vertex of its draws and its
+// first index
+struct ArenaRange {
+    unsigned int block = 0;
+    unsigned int VBO = 0, EBO = 0;
+    GLint baseVertex = 0;
+    unsigned int firstIndex = 0;
+};
+
+// one pair of shared buffers and the VAO over them
+struct ArenaBlock {
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    size_t vertexCapacity = 0, vertexCount = 0;     // in vertices
+    size_t indexCapacity = 0, indexCount = 0;       // in indices
+    unsigned int instanceVBO = 0;                   // instance buffer attached to the VAO, see attachInstances
+};
+
+// Suballocates static geometry of one vertex format and index type out of a few large buffers, so meshes share
+// a VAO instead of each having its own and can go out together in one multi-draw (see MultiDraw). Indices
+// stay relative to their mesh, draws add the range's base vertex.
+// Buffers are never reallocated: a full block is left as it is and a new one started, which is what lets the
+// upload thread write into ranges the render thread hands out. Blocks, VAOs and allocations belong to the
+// GL thread, write() works on either context.
+class GeometryArena
+{
+public:
+    // setupAttributes points the attributes of the bound VAO into the bound GL_ARRAY_BUFFER
+    GeometryArena(size_t vertexSize, GLenum indexType, function<void()> setupAttributes,
+                  size_t blockVertices = 1 << 18, size_t blockIndices = 1 << 20)
+        : vertexSize(vertexSize), indexType(indexType), setupAttributes(move(setupAttributes)),
+          blockVertices(blockVertices), blockIndices(blockIndices)
+    {
+    }
+
+    GeometryArena(const GeometryArena &) = delete;
+    GeometryArena &operator=(const GeometryArena &) = delete;
+
+    size_t indexSize() const { return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int); }
+    GLenum indices() const { return indexType; }
+
+    // GL thread: room for vertexCount vertices and indexCount indices, in a new block if the last one is full
+    ArenaRange allocate(size_t vertexCount, size_t indexCount)
+    {
+        if (blocks.empty() || blocks.back().vertexCount + vertexCount > blocks.back().vertexCapacity
+            || blocks.back().indexCount + indexCount > blocks.back().indexCapacity)
+            addBlock(max(vertexCount, blockVertices), max(indexCount, blockIndices));
+        ArenaBlock &block = blocks.back();
+        ArenaRange range;
+        range.block = blocks.size() - 1;
+        range.VBO = block.VBO;
+        range.EBO = block.EBO;
+        range.baseVertex = block.vertexCount;
+        range.firstIndex = block.indexCount;
+        block.vertexCount += vertexCount;
+        block.indexCount += indexCount;
+        return range;
+    }
+
+    // fills an allocated range, on either thread (it only touches the range's buffers). Goes through the copy
+    // target, so it changes no VAO and no other binding.
+    void write(const ArenaRange &range, const void *vertices, size_t vertexCount, const void *indices, size_t indexCount) const
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, range.VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, range.baseVertex * vertexSize, vertexCount * vertexSize, vertices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, range.EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstIndex * indexSize(), indexCount * indexSize(), indices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    unsigned int vertexArray(const ArenaRange &range) const { return blocks[range.block].VAO; }
+
+    // GL thread: makes the block's VAO read per instance data from the buffer (attach(location) of an
+    // InstanceBuffer or the like), unless it already does. Binds the VAO.
+    template <typename Instances>
+    void attachInstances(const ArenaRange &range, const Instances &instances, unsigned int location)
+    {
+        ArenaBlock &block = blocks[range.block];
+        glBindVertexArray(block.VAO);
+        if (block.instanceVBO == instances.VBO)
+            return;
+        instances.attach(location);
+        block.instanceVBO = instances.VBO;
+    }
+
+private:
+    const size_t vertexSize;
+    const GLenum indexType;
+    const function<void()> setupAttributes;
+    const size_t blockVertices, blockIndices;
+    // only ever appended, ranges refer to blocks by index
+    vector<ArenaBlock> blocks;
+
+    void addBlock(size_t vertexCapacity, size_t indexCapacity)
+    {
+        ArenaBlock block;
+        block.vertexCapacity = vertexCapacity;
+        block.indexCapacity = indexCapacity;
+        glGenVertexArrays(1, &block.VAO);
+        glGenBuffers(1, &block.VBO);
+        glGenBuffers(1, &block.EBO);
+        glBindVertexArray(block.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, block.VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexCapacity * vertexSize, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity * indexSize(), nullptr, GL_STATIC_DRAW);
+        setupAttributes();
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // the upload thread may write into the buffers next, they have to exist over there first
+        glFlush();
+        blocks.push_back(block);
+    }
+};
+
+#endif
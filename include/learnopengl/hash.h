@@ -0,0 +1,27 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a, used to key on-disk caches by the content of their source files.
+// Pass the result of a previous call as seed to hash several buffers as one stream.
+inline uint64_t fnv1a64(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+inline uint64_t fnv1a64(const std::string &str, uint64_t seed = 14695981039346656037ULL)
+{
+    return fnv1a64(str.data(), str.size(), seed);
+}
+
+#endif
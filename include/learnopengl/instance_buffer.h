@@ -0,0 +1,54 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+using namespace std;
+
+// Buffer of per-instance model matrices for instanced draws. A mat4 vertex attribute takes four consecutive
+// locations (one vec4 column each), read once per instance: the shader declares
+//   layout (location = N) in mat4 aInstanceModel;
+// and the VAO gets the buffer attached with attach(N). The instance count then only changes the size of the
+// buffer, not the number of draw calls or uniforms set.
+// Like the other GL objects in main(), the buffer is deleted by its owner while the context is still current.
+class InstanceBuffer
+{
+public:
+    unsigned int VBO = 0;
+    unsigned int count = 0;
+
+    // replaces the matrices. The storage is respecified every time, so a buffer still used by an earlier
+    // draw doesn't make this wait for it.
+    void update(const glm::mat4 *matrices, unsigned int instanceCount, GLenum usage = GL_STATIC_DRAW)
+    {
+        if (!VBO)
+            glGenBuffers(1, &VBO);
+        count = instanceCount;
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, instanceCount * sizeof(glm::mat4), matrices, usage);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void update(const vector<glm::mat4> &matrices, GLenum usage = GL_STATIC_DRAW)
+    {
+        update(matrices.data(), matrices.size(), usage);
+    }
+
+    // sets up locations location..location + 3 of the bound VAO to read one matrix per instance
+    void attach(unsigned int location) const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        for (unsigned int column = 0; column < 4; column++)
+        {
+            glEnableVertexAttribArray(location + column);
+            glVertexAttribPointer(location + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                  (void *)(column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(location + column, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
+
+#endif
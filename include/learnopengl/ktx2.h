@@ -0,0 +1,221 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Minimal reader/writer for KTX2 (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html) holding a
+// single 2D image with a precomputed mip chain in a block-compressed format. Supercompression, arrays,
+// 3D textures and cubemaps are not supported; cubemap faces are baked as separate files.
+
+// the VkFormat values we know how to upload
+enum Ktx2Format : uint32_t {
+    KTX2_FORMAT_BC1_RGB_UNORM = 131,
+    KTX2_FORMAT_BC1_RGB_SRGB = 132,
+    KTX2_FORMAT_BC1_RGBA_UNORM = 133,
+    KTX2_FORMAT_BC1_RGBA_SRGB = 134,
+    KTX2_FORMAT_BC3_UNORM = 137,
+    KTX2_FORMAT_BC3_SRGB = 138,
+    KTX2_FORMAT_BC7_UNORM = 145,
+    KTX2_FORMAT_BC7_SRGB = 146,
+    KTX2_FORMAT_ETC2_RGB8_UNORM = 147,
+    KTX2_FORMAT_ETC2_RGB8_SRGB = 148,
+    KTX2_FORMAT_ETC2_RGB8A1_UNORM = 149,
+    KTX2_FORMAT_ETC2_RGB8A1_SRGB = 150,
+    KTX2_FORMAT_ETC2_RGBA8_UNORM = 151,
+    KTX2_FORMAT_ETC2_RGBA8_SRGB = 152
+};
+
+// bytes per 4x4 block, 0 for formats we don't handle
+inline unsigned int ktx2BlockSize(uint32_t vkFormat)
+{
+    switch (vkFormat)
+    {
+        case KTX2_FORMAT_BC1_RGB_UNORM: case KTX2_FORMAT_BC1_RGB_SRGB:
+        case KTX2_FORMAT_BC1_RGBA_UNORM: case KTX2_FORMAT_BC1_RGBA_SRGB:
+        case KTX2_FORMAT_ETC2_RGB8_UNORM: case KTX2_FORMAT_ETC2_RGB8_SRGB:
+        case KTX2_FORMAT_ETC2_RGB8A1_UNORM: case KTX2_FORMAT_ETC2_RGB8A1_SRGB:
+            return 8;
+        case KTX2_FORMAT_BC3_UNORM: case KTX2_FORMAT_BC3_SRGB:
+        case KTX2_FORMAT_BC7_UNORM: case KTX2_FORMAT_BC7_SRGB:
+        case KTX2_FORMAT_ETC2_RGBA8_UNORM: case KTX2_FORMAT_ETC2_RGBA8_SRGB:
+            return 16;
+    }
+    return 0;
+}
+
+inline size_t ktx2LevelSize(uint32_t vkFormat, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * ktx2BlockSize(vkFormat);
+}
+
+static const unsigned char KTX2_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+struct Ktx2Header {
+    unsigned char identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+struct Ktx2Level {
+    int width, height;
+    const unsigned char *data;
+    size_t size;
+};
+
+// parses a KTX2 file already in memory. The returned levels point into data, level 0 is full resolution.
+inline bool parseKtx2(const unsigned char *data, size_t size, uint32_t &vkFormat, vector<Ktx2Level> &levels)
+{
+    if (size < sizeof(Ktx2Header))
+        return false;
+    Ktx2Header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0
+        || ktx2BlockSize(header.vkFormat) == 0
+        || header.supercompressionScheme != 0
+        || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1
+        || header.pixelWidth == 0 || header.pixelHeight == 0)
+        return false;
+
+    // a level count of 0 asks the loader to generate mips, we just take the one level that's there
+    uint32_t levelCount = header.levelCount == 0 ? 1 : header.levelCount;
+    if (sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex) > size)
+        return false;
+
+    vkFormat = header.vkFormat;
+    levels.clear();
+    for (uint32_t l = 0; l < levelCount; l++)
+    {
+        Ktx2LevelIndex index;
+        memcpy(&index, data + sizeof(Ktx2Header) + l * sizeof(Ktx2LevelIndex), sizeof(index));
+        Ktx2Level level;
+        level.width = max(1u, header.pixelWidth >> l);
+        level.height = max(1u, header.pixelHeight >> l);
+        level.size = ktx2LevelSize(vkFormat, level.width, level.height);
+        if (index.byteLength != level.size || index.byteOffset + index.byteLength > size)
+            return false;
+        level.data = data + index.byteOffset;
+        levels.push_back(level);
+    }
+    return true;
+}
+
+// data format descriptor for the block-compressed formats the baker writes (BC1 and BC3)
+inline vector<uint32_t> ktx2BlockDescriptor(uint32_t vkFormat)
+{
+    const bool bc3 = vkFormat == KTX2_FORMAT_BC3_UNORM || vkFormat == KTX2_FORMAT_BC3_SRGB;
+    const bool srgb = vkFormat == KTX2_FORMAT_BC1_RGB_SRGB || vkFormat == KTX2_FORMAT_BC1_RGBA_SRGB || vkFormat == KTX2_FORMAT_BC3_SRGB;
+    const uint32_t sampleCount = bc3 ? 2 : 1;
+    const uint32_t blockSize = 24 + 16 * sampleCount;
+
+    vector<uint32_t> dfd;
+    dfd.push_back(4 + blockSize);                        // dfdTotalSize
+    dfd.push_back(0);                                    // vendorId = Khronos, descriptorType = basic
+    dfd.push_back(2 | (blockSize << 16));                // versionNumber, descriptorBlockSize
+    // colorModel (BC1A = 128, BC3 = 130), primaries BT709, transfer linear/sRGB, flags
+    dfd.push_back((bc3 ? 130u : 128u) | (1u << 8) | ((srgb ? 2u : 1u) << 16));
+    dfd.push_back(3 | (3 << 8));                         // 4x4x1x1 texel block
+    dfd.push_back(ktx2BlockSize(vkFormat));              // bytesPlane0
+    dfd.push_back(0);                                    // bytesPlane4..7
+    if (bc3)
+    {
+        // alpha block first (channel id 15), then the color block
+        dfd.push_back(0 | (63u << 16) | (15u << 24));
+        dfd.push_back(0);
+        dfd.push_back(0);
+        dfd.push_back(0xFFFFFFFFu);
+        dfd.push_back(64 | (63u << 16) | (0u << 24));
+    }
+    else
+    {
+        // channel 0 is BC1 color, 15 is color with punch-through alpha
+        uint32_t channel = vkFormat == KTX2_FORMAT_BC1_RGBA_UNORM || vkFormat == KTX2_FORMAT_BC1_RGBA_SRGB ? 15u : 0u;
+        dfd.push_back(0 | (63u << 16) | (channel << 24));
+    }
+    dfd.push_back(0);
+    dfd.push_back(0);
+    dfd.push_back(0xFFFFFFFFu);
+    return dfd;
+}
+
+// writes a single-face KTX2 file, levels[0] is full resolution and every level must already be block-compressed.
+// The level data is stored smallest level first, as the spec recommends for streaming.
+inline bool writeKtx2(const string &path, uint32_t vkFormat, int width, int height, const vector<vector<unsigned char>> &levels)
+{
+    const uint64_t alignment = ktx2BlockSize(vkFormat);
+    vector<uint32_t> dfd = ktx2BlockDescriptor(vkFormat);
+
+    Ktx2Header header = {};
+    memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    header.vkFormat = vkFormat;
+    header.typeSize = 1;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.faceCount = 1;
+    header.levelCount = levels.size();
+    header.dfdByteOffset = sizeof(Ktx2Header) + levels.size() * sizeof(Ktx2LevelIndex);
+    header.dfdByteLength = dfd.size() * sizeof(uint32_t);
+
+    vector<Ktx2LevelIndex> index(levels.size());
+    uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+    for (int l = (int)levels.size() - 1; l >= 0; l--)
+    {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[l].byteOffset = offset;
+        index[l].byteLength = levels[l].size();
+        index[l].uncompressedByteLength = levels[l].size();
+        offset += levels[l].size();
+    }
+
+    string tmpPath = path + ".tmp";
+    {
+        ofstream out(tmpPath, ios::binary | ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(Ktx2LevelIndex));
+        out.write(reinterpret_cast<const char *>(dfd.data()), dfd.size() * sizeof(uint32_t));
+        uint64_t written = header.dfdByteOffset + header.dfdByteLength;
+        static const char padding[16] = {};
+        for (int l = (int)levels.size() - 1; l >= 0; l--)
+        {
+            out.write(padding, index[l].byteOffset - written);
+            out.write(reinterpret_cast<const char *>(levels[l].data()), levels[l].size());
+            written = index[l].byteOffset + levels[l].size();
+        }
+        if (!out)
+        {
+            out.close();
+            remove(tmpPath.c_str());
+            return false;
+        }
+    }
+    return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// read-only memory mapping of a whole file. The mapping lives as long as the object,
+// so pointers handed out by data() must not outlive it.
+class MappedFile
+{
+public:
+    MappedFile() : ptr(nullptr), length(0) {}
+
+    explicit MappedFile(const std::string &path) : ptr(nullptr), length(0)
+    {
+        open(path);
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) : ptr(other.ptr), length(other.length)
+    {
+        other.ptr = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile &operator=(MappedFile &&other)
+    {
+        if (this != &other)
+        {
+            close();
+            ptr = other.ptr;
+            length = other.length;
+            other.ptr = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    // maps the file at path, returns false if it doesn't exist or can't be mapped
+    bool open(const std::string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void *mapping = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps its own reference to the file, the descriptor isn't needed anymore
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+        ptr = mapping;
+        length = (size_t)st.st_size;
+        return true;
+    }
+
+    void close()
+    {
+        if (ptr)
+            munmap(ptr, length);
+        ptr = nullptr;
+        length = 0;
+    }
+
+    // asks the kernel to start reading the whole file in, for mappings that are about to be read through
+    void willNeed() const
+    {
+        if (ptr)
+            madvise(ptr, length, MADV_WILLNEED);
+    }
+
+    bool isOpen() const { return ptr != nullptr; }
+    const unsigned char *data() const { return static_cast<const unsigned char *>(ptr); }
+    size_t size() const { return length; }
+
+private:
+    void *ptr;
+    size_t length;
+};
+
+#endif
@@ -6,8 +6,18 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <learnopengl/frustum.h>
+#include <learnopengl/geometry_arena.h>
+#include <learnopengl/instance_buffer.h>
+#include <learnopengl/multi_draw.h>
 #include <learnopengl/shader.h>
+#include <learnopengl/texture_cache.h>
+#include <learnopengl/upload_thread.h>
+#include <learnopengl/vertex_packing.h>
 
+#include <cmath>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 using namespace std;
@@ -31,109 +41,370 @@ struct Texture {
     unsigned int id;
     string type;
     string path;
+    TextureHandle handle;   // keeps the shared texture alive while a mesh uses it
 };
 
+const int MAX_MESH_LODS = 4;
+
+// a level of detail: a range of the mesh's index buffer, all levels share the vertices
+struct MeshLod {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    float error;        // how far (in object space) this level may stray from the full mesh
+};
+
+// upload meshes in the compact PackedVertex layout (see vertex_packing.h) instead of the full float Vertex.
+// Set before any model is loaded; the shader has to decode it, like model_lighting.vs does.
+inline bool &meshVertexPacking()
+{
+    static bool enabled = false;
+    return enabled;
+}
+
+// free the CPU copy of the vertices and indices once a model's meshes are uploaded (Model::loadModel does it
+// after writing the mesh cache). Only bounds, counts and LODs stay around; off by default for code that
+// still wants to read the geometry.
+inline bool &meshGeometryRelease()
+{
+    static bool enabled = false;
+    return enabled;
+}
+
+// points the attributes of the bound VAO into the bound GL_ARRAY_BUFFER, laid out as Vertex or PackedVertex
+inline void setupMeshAttributes(bool packed)
+{
+    if (packed)
+    {
+        // positions (+ bitangent sign in w), normalized to the bounds
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Position));
+        // octahedral normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+        // half float texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+        // octahedral tangents, the bitangent is rebuilt from normal, tangent and sign
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Tangent));
+        return;
+    }
+
+    // set the vertex attribute pointers
+    // vertex Positions
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    // vertex normals
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+    // vertex texture coords
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+    // vertex tangent
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+    // vertex bitangent
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+}
+
+// the arena every mesh of a vertex layout and index type is suballocated from, so there's one VAO per
+// combination (per block of it, really) instead of one per mesh
+inline GeometryArena &meshArena(bool packed, GLenum indexType)
+{
+    static GeometryArena floatShort(sizeof(Vertex), GL_UNSIGNED_SHORT, [] { setupMeshAttributes(false); });
+    static GeometryArena floatInt(sizeof(Vertex), GL_UNSIGNED_INT, [] { setupMeshAttributes(false); });
+    static GeometryArena packedShort(sizeof(PackedVertex), GL_UNSIGNED_SHORT, [] { setupMeshAttributes(true); });
+    static GeometryArena packedInt(sizeof(PackedVertex), GL_UNSIGNED_INT, [] { setupMeshAttributes(true); });
+    if (packed)
+        return indexType == GL_UNSIGNED_SHORT ? packedShort : packedInt;
+    return indexType == GL_UNSIGNED_SHORT ? floatShort : floatInt;
+}
+
+// sets the per draw bounds packed meshes are decoded with, positionMin[i] and positionExtent[i] for DRAW_ID i
+inline void setPackedBounds(Shader &shader, const glm::vec3 *mins, const glm::vec3 *extents, unsigned int count)
+{
+    glUniform3fv(glGetUniformLocation(shader.ID, "positionMin"), count, &mins[0].x);
+    glUniform3fv(glGetUniformLocation(shader.ID, "positionExtent"), count, &extents[0].x);
+}
+
 class Mesh {
 public:
-    // mesh Data
+    // mesh Data, vertices and indices are empty once the geometry has been released (see ReleaseGeometry)
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
 
-    unsigned int VAO;
+    ArenaRange range;                 // where the geometry lives in meshArena(packed, indexType)
+    unsigned int vertexCount;
+    unsigned int indexCount;
+    GLenum indexType;                 // GL_UNSIGNED_SHORT whenever the vertices fit, GL_UNSIGNED_INT otherwise
+    glm::vec3 boundsMin, boundsMax;   // object space AABB
+    glm::vec3 boundsCenter;           // and bounding sphere, around the AABB center
+    float boundsRadius;
+    bool packed;                      // uploaded as PackedVertex
+    vector<MeshLod> lods;             // lods[0] is the full mesh
+    unsigned int lod = 0;             // level drawn by Draw, see Model::SelectLod
+    bool visible = true;              // false when Model::Cull found it off screen, Draw skips it then
     std::string glslIdentifierPrefix;
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor, pass the data with std::move and it ends up in the mesh without being copied
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, vector<MeshLod> lods = vector<MeshLod>())
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertices = move(vertices);
+        this->indices = move(indices);
+        this->textures = move(textures);
+        setupLods(move(lods), this->indices.size());
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+    }
+
+    // constructor for geometry that lives in memory the mesh doesn't own (e.g. a memory-mapped mesh cache).
+    // the data is handed straight to the GPU and no CPU-side copy is kept, so vertices and indices stay empty.
+    Mesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount, vector<Texture> textures,
+         vector<MeshLod> lods = vector<MeshLod>())
+    {
+        this->textures = move(textures);
+        setupLods(move(lods), indexCount);
+
+        setupMesh(vertexData, vertexCount, indexData, indexCount);
+    }
+
+    // a mesh owns its arena range and possibly a lot of geometry, it's moved around but never copied
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+    Mesh(Mesh &&) = default;
+    Mesh &operator=(Mesh &&) = default;
+
+    // frees the CPU copy of the geometry, the arena range was filled (or the upload got its own copy) in setupMesh
+    void ReleaseGeometry()
+    {
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+    }
+
+    bool HasGeometry() const
+    {
+        return vertices.size() == vertexCount && indices.size() == indexCount;
     }
 
     // render the mesh
     void Draw(Shader &shader)
     {
+        if (!visible || !Ready())
+            return;
+        BindMaterial(shader);
+        glBindVertexArray(meshArena(packed, indexType).vertexArray(range));
+        MultiDrawRange draw = DrawRange();
+        multiDraw().draw(shader, indexType, &draw, 1, 0, packed);
+        glBindVertexArray(0);
+        UnbindMaterial(shader);
+    }
+
+    // renders a copy of the mesh for every matrix in instances, in one draw call. The matrices are read per
+    // instance at locations 5 to 8, like model_lighting.vs does with instanced set (see Model::DrawInstanced).
+    void DrawInstanced(Shader &shader, const InstanceBuffer &instances)
+    {
+        if (instances.count == 0 || !visible || !Ready())
+            return;
+        BindMaterial(shader);
+        meshArena(packed, indexType).attachInstances(range, instances, 5);
+        MultiDrawRange draw = DrawRange();
+        multiDraw().draw(shader, indexType, &draw, 1, instances.count, packed);
+        glBindVertexArray(0);
+        UnbindMaterial(shader);
+    }
+
+    // the pieces Model::Draw batches meshes with: meshes that share a batch go out in one multi-draw with
+    // the material of the first one bound
+
+    // false while the geometry is still on its way from the upload thread
+    bool Ready()
+    {
+        if (pendingUpload)
+        {
+            if (!pendingUpload->published)
+                return false;
+            pendingUpload.reset();
+        }
+        return true;
+    }
+
+    // same arena block (so the same VAO and index type), same textures
+    bool SharesBatch(const Mesh &other) const
+    {
+        if (packed != other.packed || indexType != other.indexType || range.block != other.range.block
+            || glslIdentifierPrefix != other.glslIdentifierPrefix || textures.size() != other.textures.size())
+            return false;
+        for (unsigned int i = 0; i < textures.size(); i++)
+            if (textures[i].id != other.textures[i].id || textures[i].type != other.textures[i].type)
+                return false;
+        return true;
+    }
+
+    // the selected LOD, as a range of the arena block
+    MultiDrawRange DrawRange() const
+    {
+        const MeshLod &level = lods[min<size_t>(lod, lods.size() - 1)];
+        return MultiDrawRange{(GLsizei)level.indexCount, range.firstIndex + level.indexOffset, range.baseVertex};
+    }
+
+    // binds the textures and, for a packed mesh, sets its bounds as those of DRAW_ID 0
+    void BindMaterial(Shader &shader)
+    {
+        if (samplerProgram != shader.ID || samplerPrefix != glslIdentifierPrefix)
+        {
+            // retrieve the texture numbers (the N in diffuse_textureN) and the locations they end up at
+            unsigned int diffuseNr  = 1;
+            unsigned int specularNr = 1;
+            unsigned int normalNr   = 1;
+            unsigned int heightNr   = 1;
+            samplerLocations.clear();
+            for (unsigned int i = 0; i < textures.size(); i++)
+            {
+                string number;
+                string name = textures[i].type;
+                if(name == "texture_diffuse")
+                    number = std::to_string(diffuseNr++);
+                else if(name == "texture_specular")
+                    number = std::to_string(specularNr++); // transfer unsigned int to stream
+                else if(name == "texture_normal")
+                    number = std::to_string(normalNr++); // transfer unsigned int to stream
+                else if(name == "texture_height")
+                    number = std::to_string(heightNr++); // transfer unsigned int to stream
+                samplerLocations.push_back(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()));
+            }
+            samplerProgram = shader.ID;
+            samplerPrefix = glslIdentifierPrefix;
+        }
+
         // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
             glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
-            else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to stream
-
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
+            glUniform1i(samplerLocations[i], i);
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
 
+        // packed positions are relative to the bounds
+        if (packed)
+        {
+            shader.setBool("packedVertex", true);
+            glm::vec3 extent = boundsMax - boundsMin;
+            setPackedBounds(shader, &boundsMin, &extent, 1);
+        }
+    }
 
-
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    void UnbindMaterial(Shader &shader)
+    {
+        if (packed)
+            shader.setBool("packedVertex", false);
 
         // always good practice to set everything back to defaults once configured.
         glActiveTexture(GL_TEXTURE0);
     }
 
 private:
-    // render data
-    unsigned int VBO, EBO;
+    // sampler uniform locations of the textures, looked up once per shader program (and prefix)
+    unsigned int samplerProgram = 0;
+    std::string samplerPrefix;
+    vector<GLint> samplerLocations;
+
+    // the arena range being filled on the upload thread, flagged by the job's publish callback
+    struct PendingUpload {
+        bool published = false;
+    };
+    shared_ptr<PendingUpload> pendingUpload;
+
+    // without a LOD chain the whole index buffer is the only level
+    void setupLods(vector<MeshLod> lods, size_t indexCount)
+    {
+        this->lods = move(lods);
+        if (this->lods.empty())
+            this->lods.push_back(MeshLod{0, (unsigned int)indexCount, 0.0f});
+    }
 
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount)
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        this->vertexCount = vertexCount;
+        this->indexCount = indexCount;
+        packed = meshVertexPacking();
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        boundsMin = boundsMax = vertexCount > 0 ? vertexData[0].Position : glm::vec3(0.0f);
+        for (size_t i = 1; i < vertexCount; i++)
+        {
+            boundsMin = glm::min(boundsMin, vertexData[i].Position);
+            boundsMax = glm::max(boundsMax, vertexData[i].Position);
+        }
+        // the farthest vertex from the center, a bit tighter than half the AABB diagonal
+        boundsCenter = (boundsMin + boundsMax) * 0.5f;
+        float radiusSquared = 0.0f;
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            glm::vec3 offset = vertexData[i].Position - boundsCenter;
+            radiusSquared = max(radiusSquared, glm::dot(offset, offset));
+        }
+        boundsRadius = sqrt(radiusSquared);
 
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        // what actually goes into the VBO
+        const unsigned char *vertexBytes = reinterpret_cast<const unsigned char *>(vertexData);
+        size_t vertexBytesSize = vertexCount * sizeof(Vertex);
+        vector<PackedVertex> packedVertices;
+        if (packed)
+        {
+            packedVertices.reserve(vertexCount);
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                const Vertex &v = vertexData[i];
+                packedVertices.push_back(packVertex(v.Position, v.Normal, v.TexCoords, v.Tangent, v.Bitangent,
+                                                    boundsMin, boundsMax - boundsMin));
+            }
+            vertexBytes = reinterpret_cast<const unsigned char *>(packedVertices.data());
+            vertexBytesSize = vertexCount * sizeof(PackedVertex);
+        }
 
-        glBindVertexArray(0);
+        // 16-bit indices whenever every vertex can be addressed with them
+        indexType = vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        const unsigned char *indexBytes = reinterpret_cast<const unsigned char *>(indexData);
+        size_t indexBytesSize = indexCount * sizeof(unsigned int);
+        vector<uint16_t> shortIndices;
+        if (indexType == GL_UNSIGNED_SHORT)
+        {
+            shortIndices.assign(indexData, indexData + indexCount);
+            indexBytes = reinterpret_cast<const unsigned char *>(shortIndices.data());
+            indexBytesSize = indexCount * sizeof(uint16_t);
+        }
+
+        // the range is handed out here, on the GL thread; only filling it may happen elsewhere
+        GeometryArena &arena = meshArena(packed, indexType);
+        range = arena.allocate(vertexCount, indexCount);
+
+        if (uploadThread().running())
+        {
+            // the source memory may be gone (or moved) by the time the upload thread gets to it, so take a copy.
+            // the arena's VAO already points at the block, the range is drawn once the upload is published.
+            shared_ptr<vector<unsigned char>> vertexCopy = make_shared<vector<unsigned char>>(vertexBytes, vertexBytes + vertexBytesSize);
+            shared_ptr<vector<unsigned char>> indexCopy = make_shared<vector<unsigned char>>(indexBytes, indexBytes + indexBytesSize);
+            shared_ptr<PendingUpload> pending = make_shared<PendingUpload>();
+            pendingUpload = pending;
+            ArenaRange target = range;
+            size_t vertices = vertexCount, indices = indexCount;
+            uploadThread().submit([&arena, target, vertexCopy, indexCopy, vertices, indices] {
+                arena.write(target, vertexCopy->data(), vertices, indexCopy->data(), indices);
+            }, [pending] {
+                pending->published = true;
+            });
+            return;
+        }
+
+        // load data into the arena
+        // A great thing about structs is that their memory layout is sequential for all its items.
+        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+        // again translates to 3/2 floats which translates to a byte array.
+        arena.write(range, vertexBytes, vertexCount, indexBytes, indexCount);
     }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,321 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <learnopengl/asset_pack.h>
+#include <learnopengl/hash.h>
+#include <learnopengl/mesh.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Binary cache of the fully processed meshes of a model, written next to the source file as <source>.meshcache.
+// The cache is keyed by a hash of the source file content and the Assimp import flags, and holds the paths of every
+// other file the import read (.mtl files and such) with a hash of their content, so a stale cache is simply
+// ignored and rewritten. Vertex and index arrays are stored exactly as they are uploaded (16-byte aligned), which
+// lets a hit map the file (or find it in the asset pack) and pass pointers straight into glBufferData without Assimp or any intermediate copy.
+//
+// file layout:
+//   MeshCacheHeader
+//   MeshCacheEntry[meshCount]
+//   MeshCacheTexture[textureCount]
+//   MeshCacheDependency[dependencyCount]
+//   string table (texture types and paths, dependency paths, not null terminated)
+//   vertex/index blobs referenced by the entries
+
+// bump whenever the processing done between Assimp and the cache changes, so old caches get rebuilt
+const uint32_t MESH_CACHE_VERSION = 5;
+
+struct MeshCacheHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t importFlags;
+    uint64_t sourceHash;
+    uint64_t dependencyHash;    // see meshCacheDependencyHash
+    uint32_t vertexSize;
+    uint32_t meshCount;
+    uint32_t textureCount;
+    uint32_t dependencyCount;
+    uint32_t stringTableSize;
+    uint64_t fileSize;
+};
+
+struct MeshCacheEntry {
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t firstTexture;
+    uint32_t textureCount;
+    uint32_t lodCount;      // LOD index ranges, relative to the mesh's own indices
+    uint32_t lodIndexOffset[MAX_MESH_LODS];
+    uint32_t lodIndexCount[MAX_MESH_LODS];
+    float    lodError[MAX_MESH_LODS];
+};
+
+struct MeshCacheTexture {
+    uint32_t typeOffset;
+    uint32_t typeLength;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+// a file besides the source the import read, as the importer asked for it
+struct MeshCacheDependency {
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+static const char MESH_CACHE_MAGIC[8] = {'R', 'G', 'M', 'E', 'S', 'H', '\0', '\0'};
+
+// hash of everything that determines the content of a cache: the source bytes, the import flags, whether vertices
+// are packed (meshes are split for 16-bit indices by the uploaded vertex size) and the cache version
+inline uint64_t meshCacheKey(const string &sourcePath, unsigned int importFlags, bool &ok)
+{
+    AssetFile source(sourcePath);
+    ok = source.isOpen();
+    if (!ok)
+        return 0;
+    uint64_t hash = fnv1a64(source.data(), source.size());
+    hash = fnv1a64(&importFlags, sizeof(importFlags), hash);
+    const bool packed = meshVertexPacking();
+    hash = fnv1a64(&packed, sizeof(packed), hash);
+    return fnv1a64(&MESH_CACHE_VERSION, sizeof(MESH_CACHE_VERSION), hash);
+}
+
+// hash of the paths and content of the other files an import read, a missing one only counts by its path so
+// it showing up later changes the hash too
+inline uint64_t meshCacheDependencyHash(const vector<string> &paths)
+{
+    uint64_t count = paths.size();
+    uint64_t hash = fnv1a64(&count, sizeof(count));
+    for (const string &path : paths)
+    {
+        hash = fnv1a64(path, hash);
+        AssetFile file(path);
+        bool found = file.isOpen();
+        hash = fnv1a64(&found, sizeof(found), hash);
+        if (found)
+            hash = fnv1a64(file.data(), file.size(), hash);
+    }
+    return hash;
+}
+
+class MeshCacheReader
+{
+public:
+    // maps the cache and validates it against the expected key, returns false on a miss
+    bool open(const string &cachePath, uint64_t sourceHash, unsigned int importFlags)
+    {
+        if (!file.open(cachePath))
+            return false;
+        if (file.size() < sizeof(MeshCacheHeader))
+            return fail();
+
+        header = reinterpret_cast<const MeshCacheHeader *>(file.data());
+        if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0
+            || header->version != MESH_CACHE_VERSION
+            || header->importFlags != importFlags
+            || header->sourceHash != sourceHash
+            || header->vertexSize != sizeof(Vertex)
+            || header->fileSize != file.size())
+            return fail();
+
+        size_t tablesEnd = sizeof(MeshCacheHeader)
+                           + header->meshCount * sizeof(MeshCacheEntry)
+                           + header->textureCount * sizeof(MeshCacheTexture)
+                           + header->dependencyCount * sizeof(MeshCacheDependency)
+                           + header->stringTableSize;
+        if (tablesEnd > file.size())
+            return fail();
+
+        entries = reinterpret_cast<const MeshCacheEntry *>(file.data() + sizeof(MeshCacheHeader));
+        textures = reinterpret_cast<const MeshCacheTexture *>(entries + header->meshCount);
+        dependencies = reinterpret_cast<const MeshCacheDependency *>(textures + header->textureCount);
+        strings = reinterpret_cast<const char *>(dependencies + header->dependencyCount);
+
+        for (unsigned int i = 0; i < header->meshCount; i++)
+        {
+            const MeshCacheEntry &entry = entries[i];
+            if (entry.vertexOffset + (uint64_t)entry.vertexCount * sizeof(Vertex) > file.size()
+                || entry.indexOffset + (uint64_t)entry.indexCount * sizeof(unsigned int) > file.size()
+                || entry.firstTexture + entry.textureCount > header->textureCount
+                || entry.lodCount == 0 || entry.lodCount > MAX_MESH_LODS)
+                return fail();
+            for (unsigned int l = 0; l < entry.lodCount; l++)
+                if ((uint64_t)entry.lodIndexOffset[l] + entry.lodIndexCount[l] > entry.indexCount)
+                    return fail();
+        }
+        for (unsigned int i = 0; i < header->textureCount; i++)
+        {
+            if (textures[i].typeOffset + textures[i].typeLength > header->stringTableSize
+                || textures[i].pathOffset + textures[i].pathLength > header->stringTableSize)
+                return fail();
+        }
+
+        // the .mtl files and such have to be unchanged too
+        vector<string> paths;
+        for (unsigned int i = 0; i < header->dependencyCount; i++)
+        {
+            if (dependencies[i].pathOffset + dependencies[i].pathLength > header->stringTableSize)
+                return fail();
+            paths.push_back(string(strings + dependencies[i].pathOffset, dependencies[i].pathLength));
+        }
+        if (meshCacheDependencyHash(paths) != header->dependencyHash)
+            return fail();
+        return true;
+    }
+
+    unsigned int meshCount() const { return header->meshCount; }
+    const MeshCacheEntry &entry(unsigned int i) const { return entries[i]; }
+
+    const Vertex *vertices(const MeshCacheEntry &entry) const
+    {
+        return reinterpret_cast<const Vertex *>(file.data() + entry.vertexOffset);
+    }
+
+    const unsigned int *indices(const MeshCacheEntry &entry) const
+    {
+        return reinterpret_cast<const unsigned int *>(file.data() + entry.indexOffset);
+    }
+
+    vector<MeshLod> lods(const MeshCacheEntry &entry) const
+    {
+        vector<MeshLod> result;
+        for (unsigned int l = 0; l < entry.lodCount; l++)
+            result.push_back(MeshLod{entry.lodIndexOffset[l], entry.lodIndexCount[l], entry.lodError[l]});
+        return result;
+    }
+
+    string textureType(unsigned int i) const { return string(strings + textures[i].typeOffset, textures[i].typeLength); }
+    string texturePath(unsigned int i) const { return string(strings + textures[i].pathOffset, textures[i].pathLength); }
+
+private:
+    AssetFile file;
+    const MeshCacheHeader *header = nullptr;
+    const MeshCacheEntry *entries = nullptr;
+    const MeshCacheTexture *textures = nullptr;
+    const MeshCacheDependency *dependencies = nullptr;
+    const char *strings = nullptr;
+
+    bool fail()
+    {
+        file.close();
+        return false;
+    }
+};
+
+// writes the cache for already processed meshes, dependencies are the other files the import read. The file
+// is written to a temporary name and renamed into place, so a crash halfway through never leaves a truncated
+// cache behind.
+inline bool writeMeshCache(const string &cachePath, uint64_t sourceHash, const vector<string> &dependencies,
+                           unsigned int importFlags, const vector<Mesh> &meshes)
+{
+    const uint64_t alignment = 16;
+    auto align = [alignment](uint64_t offset) { return (offset + alignment - 1) & ~(alignment - 1); };
+
+    vector<MeshCacheEntry> entries;
+    vector<MeshCacheTexture> textures;
+    string strings;
+    for (const Mesh &mesh : meshes)
+    {
+        // nothing to write once the geometry is gone
+        if (!mesh.HasGeometry())
+            return false;
+        MeshCacheEntry entry = {};
+        entry.vertexCount = mesh.vertices.size();
+        entry.indexCount = mesh.indices.size();
+        entry.firstTexture = textures.size();
+        entry.textureCount = mesh.textures.size();
+        entry.lodCount = mesh.lods.size();
+        for (unsigned int l = 0; l < mesh.lods.size(); l++)
+        {
+            entry.lodIndexOffset[l] = mesh.lods[l].indexOffset;
+            entry.lodIndexCount[l] = mesh.lods[l].indexCount;
+            entry.lodError[l] = mesh.lods[l].error;
+        }
+        for (const Texture &texture : mesh.textures)
+        {
+            MeshCacheTexture record;
+            record.typeOffset = strings.size();
+            record.typeLength = texture.type.size();
+            strings += texture.type;
+            record.pathOffset = strings.size();
+            record.pathLength = texture.path.size();
+            strings += texture.path;
+            textures.push_back(record);
+        }
+        entries.push_back(entry);
+    }
+    vector<MeshCacheDependency> dependencyRecords;
+    for (const string &path : dependencies)
+    {
+        dependencyRecords.push_back(MeshCacheDependency{(uint32_t)strings.size(), (uint32_t)path.size()});
+        strings += path;
+    }
+
+    // lay out the blobs after the tables
+    const uint64_t tablesSize = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry)
+                                + textures.size() * sizeof(MeshCacheTexture)
+                                + dependencyRecords.size() * sizeof(MeshCacheDependency) + strings.size();
+    uint64_t offset = tablesSize;
+    for (MeshCacheEntry &entry : entries)
+    {
+        entry.vertexOffset = align(offset);
+        offset = entry.vertexOffset + (uint64_t)entry.vertexCount * sizeof(Vertex);
+        entry.indexOffset = align(offset);
+        offset = entry.indexOffset + (uint64_t)entry.indexCount * sizeof(unsigned int);
+    }
+
+    MeshCacheHeader header = {};
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    header.importFlags = importFlags;
+    header.sourceHash = sourceHash;
+    header.dependencyHash = meshCacheDependencyHash(dependencies);
+    header.vertexSize = sizeof(Vertex);
+    header.meshCount = entries.size();
+    header.textureCount = textures.size();
+    header.dependencyCount = dependencyRecords.size();
+    header.stringTableSize = strings.size();
+    header.fileSize = offset;
+
+    string tmpPath = cachePath + ".tmp";
+    {
+        ofstream out(tmpPath, ios::binary | ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(MeshCacheEntry));
+        out.write(reinterpret_cast<const char *>(textures.data()), textures.size() * sizeof(MeshCacheTexture));
+        out.write(reinterpret_cast<const char *>(dependencyRecords.data()), dependencyRecords.size() * sizeof(MeshCacheDependency));
+        out.write(strings.data(), strings.size());
+
+        static const char padding[16] = {};
+        uint64_t written = tablesSize;
+        for (unsigned int i = 0; i < entries.size(); i++)
+        {
+            const MeshCacheEntry &entry = entries[i];
+            const Mesh &mesh = meshes[i];
+            out.write(padding, entry.vertexOffset - written);
+            out.write(reinterpret_cast<const char *>(mesh.vertices.data()), entry.vertexCount * sizeof(Vertex));
+            written = entry.vertexOffset + (uint64_t)entry.vertexCount * sizeof(Vertex);
+            out.write(padding, entry.indexOffset - written);
+            out.write(reinterpret_cast<const char *>(mesh.indices.data()), entry.indexCount * sizeof(unsigned int));
+            written = entry.indexOffset + (uint64_t)entry.indexCount * sizeof(unsigned int);
+        }
+        if (!out)
+        {
+            out.close();
+            remove(tmpPath.c_str());
+            return false;
+        }
+    }
+    return rename(tmpPath.c_str(), cachePath.c_str()) == 0;
+}
+
+#endif
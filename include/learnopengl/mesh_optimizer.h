@@ -0,0 +1,408 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <learnopengl/hash.h>
+#include <learnopengl/mesh.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Import-time optimization of an indexed triangle list, run on Assimp's output before the mesh cache is written:
+//   1. weld bit-identical vertices (Assimp hands out one vertex per face corner without JoinIdenticalVertices)
+//   2. reorder triangles for the post-transform vertex cache (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+//   3. reorder clusters of those triangles against overdraw (Sander et al., "Fast Triangle Reordering for
+//      Vertex Locality and Reduced Overdraw"), accepting a slightly worse cache hit rate
+//   4. reorder the vertices into the order the index buffer first touches them, for the pre-transform fetch
+
+// average cache miss ratio (transformed vertices per triangle) and average transform to vertex ratio
+struct VertexCacheStats {
+    float acmr;
+    float atvr;
+};
+
+// runs the indices through a FIFO cache of the given size, the common model for hardware post-transform caches
+inline VertexCacheStats analyzeVertexCache(const vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = 16)
+{
+    vector<unsigned int> timestamps(vertexCount, 0);
+    unsigned int time = cacheSize + 1;
+    size_t misses = 0;
+    for (unsigned int index : indices)
+    {
+        if (time - timestamps[index] > cacheSize)
+        {
+            timestamps[index] = time++;
+            misses++;
+        }
+    }
+    VertexCacheStats stats;
+    stats.acmr = indices.empty() ? 0.0f : (float)misses / (indices.size() / 3);
+    stats.atvr = vertexCount == 0 ? 0.0f : (float)misses / vertexCount;
+    return stats;
+}
+
+// merges vertices with identical attributes, rewriting the indices. Returns the new vertex count.
+inline size_t weldVertices(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    // open addressing table of vertex indices, at most half full
+    size_t tableSize = 1;
+    while (tableSize < vertices.size() * 2)
+        tableSize *= 2;
+    const unsigned int empty = ~0u;
+    vector<unsigned int> table(tableSize, empty);
+
+    vector<unsigned int> remap(vertices.size());
+    vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        size_t slot = fnv1a64(&vertices[i], sizeof(Vertex)) & (tableSize - 1);
+        while (table[slot] != empty && memcmp(&welded[table[slot]], &vertices[i], sizeof(Vertex)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+        if (table[slot] == empty)
+        {
+            table[slot] = welded.size();
+            welded.push_back(vertices[i]);
+        }
+        remap[i] = table[slot];
+    }
+    for (unsigned int &index : indices)
+        index = remap[index];
+    vertices.swap(welded);
+    return vertices.size();
+}
+
+// Forsyth's greedy vertex cache optimization, tuned for an LRU cache of 32 entries
+inline void optimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount)
+{
+    const int cacheSize = 32;
+    const int maxValence = 32;
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // score tables: recently used vertices score high (except the last triangle's, to avoid strips that
+    // turn back on themselves), vertices with few triangles left score high so they get finished off
+    float cacheScores[cacheSize];
+    for (int i = 0; i < cacheSize; i++)
+        cacheScores[i] = i < 3 ? 0.75f : powf(1.0f - (float)(i - 3) / (cacheSize - 3), 1.5f);
+    float valenceScores[maxValence + 1];
+    valenceScores[0] = 0.0f;
+    for (int i = 1; i <= maxValence; i++)
+        valenceScores[i] = 2.0f / sqrtf((float)i);
+
+    // triangles adjacent to each vertex, remaining[v] of them not emitted yet
+    vector<unsigned int> remaining(vertexCount, 0);
+    for (unsigned int index : indices)
+        remaining[index]++;
+    vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    vector<unsigned int> adjacency(indices.size());
+    {
+        vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = t;
+    }
+
+    vector<int> cachePosition(vertexCount, -1);
+    auto vertexScore = [&](unsigned int v) {
+        if (remaining[v] == 0)
+            return -1.0f;
+        float score = cachePosition[v] >= 0 ? cacheScores[cachePosition[v]] : 0.0f;
+        return score + valenceScores[min<unsigned int>(remaining[v], maxValence)];
+    };
+    vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexScore(v);
+    vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+    vector<char> emitted(triangleCount, 0);
+    vector<unsigned int> result;
+    result.reserve(indices.size());
+    unsigned int cache[cacheSize + 3];
+    int cacheCount = 0;
+    size_t cursor = 0;
+    long best = -1;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+    {
+        if (best < 0)
+        {
+            // nothing in the cache connects anywhere, start over at the next untouched triangle
+            while (emitted[cursor])
+                cursor++;
+            best = cursor;
+        }
+        const unsigned int *triangle = &indices[best * 3];
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[best] = 1;
+
+        // the triangle's vertices move to the front of the cache, the rest shift back
+        unsigned int next[cacheSize + 3];
+        int nextCount = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = triangle[k];
+            next[nextCount++] = v;
+            // drop the triangle from the vertex's adjacency
+            unsigned int *begin = &adjacency[offsets[v]], *end = begin + remaining[v];
+            *find(begin, end, (unsigned int)best) = *(end - 1);
+            remaining[v]--;
+        }
+        for (int i = 0; i < cacheCount; i++)
+            if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+                next[nextCount++] = cache[i];
+
+        // rescore everything that moved, the ones that fell out included
+        best = -1;
+        float bestScore = -1.0f;
+        for (int i = 0; i < nextCount; i++)
+        {
+            unsigned int v = next[i];
+            cachePosition[v] = i < cacheSize ? i : -1;
+            float score = vertexScore(v);
+            float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+            for (unsigned int a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+            {
+                unsigned int t = adjacency[a];
+                triangleScores[t] += delta;
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+        cacheCount = min(nextCount, cacheSize);
+        memcpy(cache, next, cacheCount * sizeof(unsigned int));
+    }
+    indices.swap(result);
+}
+
+// splits the cache-optimized triangle order into clusters and sorts those so outward facing ones come first.
+// threshold is how much worse than the cache-optimized ACMR a cluster may get; 1.05 allows 5%.
+inline void optimizeOverdraw(vector<unsigned int> &indices, const vector<Vertex> &vertices, float threshold = 1.05f)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+    const unsigned int cacheSize = 16;
+
+    // hard boundaries: triangles that miss the cache on all three vertices start a new cluster anyway
+    vector<size_t> hard;
+    {
+        vector<unsigned int> timestamps(vertices.size(), 0);
+        unsigned int time = cacheSize + 1;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            unsigned int misses = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int index = indices[t * 3 + k];
+                if (time - timestamps[index] > cacheSize)
+                {
+                    timestamps[index] = time++;
+                    misses++;
+                }
+            }
+            if (t == 0 || misses == 3)
+                hard.push_back(t);
+        }
+        hard.push_back(triangleCount);
+    }
+
+    // soft boundaries: within each hard cluster, cut as soon as a cluster (simulated from a cold cache) gets
+    // within the threshold of the whole hard cluster's ACMR
+    vector<size_t> clusters;
+    vector<unsigned int> timestamps(vertices.size(), 0);
+    unsigned int time = cacheSize + 1;
+    for (size_t h = 0; h + 1 < hard.size(); h++)
+    {
+        size_t start = hard[h], end = hard[h + 1];
+        size_t clusterMisses = 0;
+        for (size_t t = start; t < end; t++)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int index = indices[t * 3 + k];
+                if (time - timestamps[index] > cacheSize)
+                {
+                    timestamps[index] = time++;
+                    clusterMisses++;
+                }
+            }
+        const float target = threshold * clusterMisses / (end - start);
+
+        time += cacheSize + 1; // cold cache
+        clusters.push_back(start);
+        size_t misses = 0, first = start;
+        for (size_t t = start; t < end; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int index = indices[t * 3 + k];
+                if (time - timestamps[index] > cacheSize)
+                {
+                    timestamps[index] = time++;
+                    misses++;
+                }
+            }
+            if (t + 1 < end && (float)misses / (t + 1 - first) <= target)
+            {
+                clusters.push_back(t + 1);
+                misses = 0;
+                first = t + 1;
+                time += cacheSize + 1;
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+
+    // sort key: how far the cluster sits out along its own normal, relative to the mesh centroid
+    glm::vec3 meshCentroid(0.0f);
+    for (unsigned int index : indices)
+        meshCentroid += vertices[index].Position;
+    meshCentroid /= (float)indices.size();
+
+    const size_t clusterCount = clusters.size() - 1;
+    vector<float> keys(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+        {
+            const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+            float a = glm::length(n);
+            centroid += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        float normalLength = glm::length(normal);
+        if (area > 0.0f)
+            centroid /= area;
+        if (normalLength > 0.0f)
+            normal /= normalLength;
+        keys[c] = glm::dot(centroid - meshCentroid, normal);
+    }
+
+    vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+        order[c] = c;
+    stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+    vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (size_t c : order)
+        result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+    indices.swap(result);
+}
+
+// renumbers the vertices in the order the indices first reference them, unreferenced ones are dropped
+inline void optimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    const unsigned int unused = ~0u;
+    vector<unsigned int> remap(vertices.size(), unused);
+    vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (unsigned int &index : indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+// Splits a mesh with more vertices than 16-bit indices can address into chunks that fit, walking the triangles
+// in their (already optimized) order so every chunk stays a contiguous, cache friendly run. Vertices on the
+// seams get duplicated, so it only splits when that costs less than the index bytes saved; vertexSize is the
+// size of a vertex as uploaded. Returns false and leaves the outputs empty when the mesh should stay whole.
+inline bool splitForShortIndices(const vector<Vertex> &vertices, const vector<unsigned int> &indices, size_t vertexSize,
+                                 vector<vector<Vertex>> &chunkVertices, vector<vector<unsigned int>> &chunkIndices)
+{
+    const size_t maxChunkVertices = 65536;
+    chunkVertices.clear();
+    chunkIndices.clear();
+    if (vertices.size() <= maxChunkVertices)
+        return false;
+
+    const unsigned int none = ~0u;
+    vector<unsigned int> chunkOf(vertices.size(), none); // chunk a vertex was last added to
+    vector<unsigned int> localIndex(vertices.size());
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        size_t added = 0;
+        if (!chunkVertices.empty())
+            for (int k = 0; k < 3; k++)
+                if (chunkOf[indices[t + k]] != chunkVertices.size() - 1)
+                    added++;
+        if (chunkVertices.empty() || chunkVertices.back().size() + added > maxChunkVertices)
+        {
+            chunkVertices.emplace_back();
+            chunkIndices.emplace_back();
+        }
+        const unsigned int chunk = chunkVertices.size() - 1;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int index = indices[t + k];
+            if (chunkOf[index] != chunk)
+            {
+                chunkOf[index] = chunk;
+                localIndex[index] = chunkVertices.back().size();
+                chunkVertices.back().push_back(vertices[index]);
+            }
+            chunkIndices.back().push_back(localIndex[index]);
+        }
+    }
+
+    size_t splitVertexCount = 0;
+    for (const vector<Vertex> &chunk : chunkVertices)
+        splitVertexCount += chunk.size();
+    const size_t duplicatedBytes = (splitVertexCount - vertices.size()) * vertexSize;
+    const size_t savedBytes = indices.size() * (sizeof(unsigned int) - sizeof(uint16_t));
+    if (duplicatedBytes >= savedBytes)
+    {
+        chunkVertices.clear();
+        chunkIndices.clear();
+        return false;
+    }
+    return true;
+}
+
+// the whole pipeline, prints the before/after statistics of the mesh
+inline void optimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices, const string &name)
+{
+    if (indices.size() < 3)
+        return;
+    const size_t vertexCountBefore = vertices.size();
+    const VertexCacheStats before = analyzeVertexCache(indices, vertices.size());
+
+    weldVertices(vertices, indices);
+    optimizeVertexCache(indices, vertices.size());
+    optimizeOverdraw(indices, vertices);
+    optimizeVertexFetch(vertices, indices);
+
+    const VertexCacheStats after = analyzeVertexCache(indices, vertices.size());
+    std::cout << "MESH::OPTIMIZE " << (name.empty() ? "<unnamed>" : name) << ": " << indices.size() / 3 << " triangles, "
+              << vertexCountBefore << " -> " << vertices.size() << " vertices, ACMR " << before.acmr << " -> " << after.acmr
+              << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
+
+#endif
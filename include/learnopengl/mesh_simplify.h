@@ -0,0 +1,230 @@
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include <learnopengl/mesh.h>
+#include <learnopengl/mesh_optimizer.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Import-time LOD generation. Each LOD is a new index list over the same vertices, made by quadric error metric
+// half-edge collapses (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics"): a vertex is
+// merged into a neighbour, so no new vertices appear and every LOD can share the mesh's vertex buffer.
+// Vertices on open borders and attribute seams (which show up as borders once the vertices are welded) never
+// move, so LODs don't crack or tear UVs apart.
+
+// sum of squared distances to a set of planes, divided by their total weight (area) when evaluated
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0, c = 0;
+    double weight = 0;
+
+    void addPlane(const glm::vec3 &normal, float distance, float w)
+    {
+        a00 += w * normal.x * normal.x; a01 += w * normal.x * normal.y; a02 += w * normal.x * normal.z;
+        a11 += w * normal.y * normal.y; a12 += w * normal.y * normal.z; a22 += w * normal.z * normal.z;
+        b0 += w * normal.x * distance; b1 += w * normal.y * distance; b2 += w * normal.z * distance;
+        c += w * distance * distance;
+        weight += w;
+    }
+
+    void add(const Quadric &o)
+    {
+        a00 += o.a00; a01 += o.a01; a02 += o.a02; a11 += o.a11; a12 += o.a12; a22 += o.a22;
+        b0 += o.b0; b1 += o.b1; b2 += o.b2; c += o.c;
+        weight += o.weight;
+    }
+
+    // mean squared distance of p to the planes
+    double error(const glm::vec3 &p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                   + 2 * (b0 * x + b1 * y + b2 * z) + c;
+        return weight > 0 ? fabs(e) / weight : 0.0;
+    }
+};
+
+// collapses edges until at most targetIndexCount indices are left or the next collapse would move the surface
+// further than maxError. Returns the error of the result (an object space distance).
+inline float simplifyMesh(const vector<Vertex> &vertices, vector<unsigned int> &indices, size_t targetIndexCount, float maxError)
+{
+    const size_t vertexCount = vertices.size();
+
+    vector<Quadric> quadrics(vertexCount);
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        const glm::vec3 &p0 = vertices[indices[t]].Position, &p1 = vertices[indices[t + 1]].Position, &p2 = vertices[indices[t + 2]].Position;
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(normal);
+        if (area <= 0.0f)
+            continue;
+        normal /= area;
+        for (int k = 0; k < 3; k++)
+            quadrics[indices[t + k]].addPlane(normal, -glm::dot(normal, p0), area);
+    }
+
+    // a directed edge without its reverse is on a border (or a seam); its vertices stay put
+    vector<char> locked(vertexCount, 0);
+    {
+        vector<pair<unsigned int, unsigned int>> edges;
+        edges.reserve(indices.size());
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+            for (int k = 0; k < 3; k++)
+                edges.push_back(make_pair(indices[t + k], indices[t + (k + 1) % 3]));
+        sort(edges.begin(), edges.end());
+        for (const pair<unsigned int, unsigned int> &edge : edges)
+        {
+            if (!binary_search(edges.begin(), edges.end(), make_pair(edge.second, edge.first)))
+                locked[edge.first] = locked[edge.second] = 1;
+        }
+    }
+
+    struct Collapse {
+        unsigned int from, to;
+        double error;
+    };
+    vector<unsigned int> remap(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        remap[v] = v;
+    const double maxSquaredError = (double)maxError * maxError;
+    double resultError = 0.0;
+
+    while (indices.size() > targetIndexCount)
+    {
+        // triangles around each vertex
+        vector<unsigned int> offsets(vertexCount + 1, 0);
+        for (unsigned int index : indices)
+            offsets[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+        vector<unsigned int> adjacency(indices.size());
+        {
+            vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++)
+                adjacency[fill[indices[i]]++] = i / 3;
+        }
+
+        vector<Collapse> collapses;
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+                if (!locked[a])
+                    collapses.push_back(Collapse{a, b, quadrics[a].error(vertices[b].Position)});
+                if (!locked[b])
+                    collapses.push_back(Collapse{b, a, quadrics[b].error(vertices[a].Position)});
+            }
+        }
+        sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) { return x.error < y.error; });
+
+        // every collapse of an interior edge takes out two triangles; at most one collapse per vertex per pass
+        const size_t trianglesToRemove = (indices.size() - targetIndexCount) / 3;
+        size_t removed = 0, applied = 0;
+        vector<char> touched(vertexCount, 0);
+        for (const Collapse &collapse : collapses)
+        {
+            if (collapse.error > maxSquaredError || removed >= trianglesToRemove)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            // moving `from` onto `to` must not flip any of the triangles that survive
+            const glm::vec3 &target = vertices[collapse.to].Position;
+            bool flips = false;
+            for (unsigned int a = offsets[collapse.from]; a < offsets[collapse.from + 1] && !flips; a++)
+            {
+                const unsigned int *triangle = &indices[adjacency[a] * 3];
+                unsigned int corners[3] = {remap[triangle[0]], remap[triangle[1]], remap[triangle[2]]};
+                if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+                    continue;
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    before[k] = vertices[corners[k]].Position;
+                    after[k] = corners[k] == collapse.from ? target : before[k];
+                }
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                flips = glm::dot(normalBefore, normalAfter) <= 0.0f;
+            }
+            if (flips)
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            touched[collapse.from] = touched[collapse.to] = 1;
+            resultError = max(resultError, collapse.error);
+            removed += 2;
+            applied++;
+        }
+        if (applied == 0)
+            break;
+
+        // apply the pass, dropping the triangles that collapsed
+        vector<unsigned int> next;
+        next.reserve(indices.size());
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            unsigned int i0 = remap[indices[t]], i1 = remap[indices[t + 1]], i2 = remap[indices[t + 2]];
+            if (i0 != i1 && i1 != i2 && i0 != i2)
+            {
+                next.push_back(i0);
+                next.push_back(i1);
+                next.push_back(i2);
+            }
+        }
+        indices.swap(next);
+    }
+    return (float)sqrt(resultError);
+}
+
+// Turns the index list into the concatenated index lists of up to MAX_MESH_LODS levels, each about half the
+// triangles of the one before. Every level is simplified from the full mesh (so its error is measured against
+// the original surface) and reordered for the vertex cache. The chain stops early once a level can't get within
+// the error bound or no longer removes a meaningful share of the triangles.
+inline vector<MeshLod> generateLods(const vector<Vertex> &vertices, vector<unsigned int> &indices, const string &name)
+{
+    vector<MeshLod> lods(1, MeshLod{0, (unsigned int)indices.size(), 0.0f});
+    if (indices.size() < 3 * 64)
+        return lods;
+
+    glm::vec3 boundsMin = vertices[0].Position, boundsMax = vertices[0].Position;
+    for (const Vertex &vertex : vertices)
+    {
+        boundsMin = glm::min(boundsMin, vertex.Position);
+        boundsMax = glm::max(boundsMax, vertex.Position);
+    }
+    // nothing coarser than a few percent of the mesh size is worth keeping as a LOD
+    const float maxError = 0.05f * glm::length(boundsMax - boundsMin);
+
+    const vector<unsigned int> full(indices.begin(), indices.end());
+    size_t previousCount = full.size();
+    for (int level = 1; level < MAX_MESH_LODS; level++)
+    {
+        vector<unsigned int> lod = full;
+        size_t target = (full.size() >> level) / 3 * 3;
+        float error = simplifyMesh(vertices, lod, target, maxError);
+        if (lod.empty() || lod.size() > previousCount * 4 / 5)
+            break;
+        optimizeVertexCache(lod, vertices.size());
+        lods.push_back(MeshLod{(unsigned int)indices.size(), (unsigned int)lod.size(), max(error, lods.back().error)});
+        indices.insert(indices.end(), lod.begin(), lod.end());
+        previousCount = lod.size();
+    }
+
+    std::cout << "MESH::LOD " << (name.empty() ? "<unnamed>" : name) << ":";
+    for (const MeshLod &lod : lods)
+        std::cout << " " << lod.indexCount / 3 << " (" << lod.error << ")";
+    std::cout << std::endl;
+    return lods;
+}
+
+#endif
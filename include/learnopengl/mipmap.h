@@ -0,0 +1,242 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// CPU mip chain generation, run on the loader's worker threads and by the texture baker instead of glGenerateMipmap.
+// Levels are filtered in linear light: every level is expanded to 16-bit RGBA (color channels decoded from sRGB
+// when asked to), box filtered with an SSE2/AVX2 kernel and encoded back to 8 bits, so dark and bright texels
+// no longer average into a too dark mip. Alpha and non-color data are filtered as they are.
+
+struct MipLevel {
+    int width, height;
+    vector<unsigned char> pixels;
+};
+
+struct SrgbTables {
+    uint16_t toLinear[256];
+    unsigned char fromLinear[65536];
+
+    SrgbTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            double c = i / 255.0;
+            double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+            toLinear[i] = (uint16_t)lround(linear * 65535.0);
+        }
+        for (int i = 0; i < 65536; i++)
+        {
+            double linear = i / 65535.0;
+            double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+            fromLinear[i] = (unsigned char)lround(min(1.0, c) * 255.0);
+        }
+    }
+};
+
+inline const SrgbTables &srgbTables()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+// a level in linear light, always 4 channels of 16 bits; unused channels stay 0
+struct LinearLevel {
+    int width, height;
+    vector<uint16_t> texels;
+};
+
+inline bool isSrgbChannel(int channel, int nrComponents, bool srgb)
+{
+    return srgb && nrComponents >= 3 && channel < 3;
+}
+
+inline LinearLevel toLinear(const MipLevel &level, int nrComponents, bool srgb)
+{
+    // one decode table per channel keeps the inner loop branch free
+    const SrgbTables &tables = srgbTables();
+    uint16_t plain[256];
+    for (int i = 0; i < 256; i++)
+        plain[i] = (uint16_t)(i * 257);
+    const uint16_t *decode[4];
+    for (int c = 0; c < nrComponents; c++)
+        decode[c] = isSrgbChannel(c, nrComponents, srgb) ? tables.toLinear : plain;
+
+    LinearLevel out;
+    out.width = level.width;
+    out.height = level.height;
+    out.texels.assign((size_t)level.width * level.height * 4, 0);
+    const size_t count = (size_t)level.width * level.height;
+    const unsigned char *src = level.pixels.data();
+    uint16_t *dst = out.texels.data();
+    for (size_t i = 0; i < count; i++, src += nrComponents, dst += 4)
+        for (int c = 0; c < nrComponents; c++)
+            dst[c] = decode[c][src[c]];
+    return out;
+}
+
+inline MipLevel fromLinear(const LinearLevel &level, int nrComponents, bool srgb)
+{
+    const SrgbTables &tables = srgbTables();
+    bool encode[4];
+    for (int c = 0; c < nrComponents; c++)
+        encode[c] = isSrgbChannel(c, nrComponents, srgb);
+
+    MipLevel out;
+    out.width = level.width;
+    out.height = level.height;
+    const size_t count = (size_t)level.width * level.height;
+    out.pixels.resize(count * nrComponents);
+    const uint16_t *src = level.texels.data();
+    unsigned char *dst = out.pixels.data();
+    for (size_t i = 0; i < count; i++, src += 4, dst += nrComponents)
+        for (int c = 0; c < nrComponents; c++)
+            dst[c] = encode[c] ? tables.fromLinear[src[c]] : (unsigned char)((src[c] * 255u + 32767u) / 65535u);
+    return out;
+}
+
+// averages the 2x2 texels at a0, a1 (upper row) and b0, b1 (lower row) into dst, all 4 channels
+inline void averageTexel(const uint16_t *a0, const uint16_t *a1, const uint16_t *b0, const uint16_t *b1, uint16_t *dst)
+{
+    for (int c = 0; c < 4; c++)
+        dst[c] = (uint16_t)((a0[c] + a1[c] + b0[c] + b1[c] + 2u) >> 2);
+}
+
+#if defined(__SSE2__)
+// 2 source texels (16 bytes) of each row -> the rounded average as 4 x 32-bit
+inline __m128i averageTexelsSse2(__m128i a, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(a, zero), _mm_unpackhi_epi16(a, zero)),
+                                _mm_add_epi32(_mm_unpacklo_epi16(b, zero), _mm_unpackhi_epi16(b, zero)));
+    return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+}
+
+// packs 8 x 32-bit values in [0, 65535] to 16 bits; SSE2 only has a signed saturating pack, so bias around it
+inline __m128i packUnsigned16Sse2(__m128i lo, __m128i hi)
+{
+    const __m128i bias = _mm_set1_epi32(32768);
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(lo, bias), _mm_sub_epi32(hi, bias));
+    return _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000));
+}
+#endif
+
+// filters one row of 2x2 blocks, rowA/rowB are the two source rows. Needs a source at least 2 texels wide.
+inline void downsampleRow(const uint16_t *rowA, const uint16_t *rowB, uint16_t *dst, int dstWidth)
+{
+    int x = 0;
+#if defined(__AVX2__)
+    // 4 output texels per iteration; unpacking and packing stay within 128-bit lanes, the permute puts
+    // the texels back in order
+    for (; x + 4 <= dstWidth; x += 4)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i sums[2];
+        for (int half = 0; half < 2; half++)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rowA + (x + 2 * half) * 8));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rowB + (x + 2 * half) * 8));
+            __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(a, zero), _mm256_unpackhi_epi16(a, zero)),
+                                           _mm256_add_epi32(_mm256_unpacklo_epi16(b, zero), _mm256_unpackhi_epi16(b, zero)));
+            sums[half] = _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(2)), 2);
+        }
+        __m256i packed = _mm256_packus_epi32(sums[0], sums[1]);
+        packed = _mm256_permute4x64_epi64(packed, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x * 4), packed);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; x + 2 <= dstWidth; x += 2)
+    {
+        const uint16_t *a = rowA + x * 8, *b = rowB + x * 8;
+        __m128i first = averageTexelsSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)),
+                                          _mm_loadu_si128(reinterpret_cast<const __m128i *>(b)));
+        __m128i second = averageTexelsSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 8)),
+                                           _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4), packUnsigned16Sse2(first, second));
+    }
+#endif
+    for (; x < dstWidth; x++)
+        averageTexel(rowA + x * 8, rowA + x * 8 + 4, rowB + x * 8, rowB + x * 8 + 4, dst + x * 4);
+}
+
+// 2x2 box filter down to the next level, an odd last row/column is dropped like GL does
+inline LinearLevel downsample(const LinearLevel &src)
+{
+    LinearLevel dst;
+    dst.width = max(1, src.width / 2);
+    dst.height = max(1, src.height / 2);
+    dst.texels.resize((size_t)dst.width * dst.height * 4);
+    for (int y = 0; y < dst.height; y++)
+    {
+        const uint16_t *rowA = &src.texels[(size_t)min(2 * y, src.height - 1) * src.width * 4];
+        const uint16_t *rowB = &src.texels[(size_t)min(2 * y + 1, src.height - 1) * src.width * 4];
+        uint16_t *out = &dst.texels[(size_t)y * dst.width * 4];
+        if (src.width >= 2)
+            downsampleRow(rowA, rowB, out, dst.width);
+        else
+            averageTexel(rowA, rowA, rowB, rowB, out);
+    }
+    return dst;
+}
+
+// bilinear resampling to width x height, for images that have to match the size of others (texture array
+// layers). Meant for sizes that are close, a big reduction should go through downsample() first.
+inline LinearLevel resample(const LinearLevel &src, int width, int height)
+{
+    LinearLevel dst;
+    dst.width = width;
+    dst.height = height;
+    dst.texels.resize((size_t)width * height * 4);
+    for (int y = 0; y < height; y++)
+    {
+        float sy = min(max((y + 0.5f) * src.height / height - 0.5f, 0.0f), (float)(src.height - 1));
+        int y0 = (int)sy, y1 = min(y0 + 1, src.height - 1);
+        float fy = sy - y0;
+        for (int x = 0; x < width; x++)
+        {
+            float sx = min(max((x + 0.5f) * src.width / width - 0.5f, 0.0f), (float)(src.width - 1));
+            int x0 = (int)sx, x1 = min(x0 + 1, src.width - 1);
+            float fx = sx - x0;
+            const uint16_t *a0 = &src.texels[((size_t)y0 * src.width + x0) * 4];
+            const uint16_t *a1 = &src.texels[((size_t)y0 * src.width + x1) * 4];
+            const uint16_t *b0 = &src.texels[((size_t)y1 * src.width + x0) * 4];
+            const uint16_t *b1 = &src.texels[((size_t)y1 * src.width + x1) * 4];
+            uint16_t *out = &dst.texels[((size_t)y * width + x) * 4];
+            for (int c = 0; c < 4; c++)
+            {
+                float top = a0[c] + (a1[c] - a0[c]) * fx;
+                float bottom = b0[c] + (b1[c] - b0[c]) * fx;
+                out[c] = (uint16_t)(top + (bottom - top) * fy + 0.5f);
+            }
+        }
+    }
+    return dst;
+}
+
+// appends levels until the chain reaches 1x1, levels[0] must hold the full resolution image.
+// srgb marks color images, their RGB channels are filtered in linear light.
+inline void buildMipChain(vector<MipLevel> &levels, int nrComponents, bool srgb)
+{
+    if (levels.back().width <= 1 && levels.back().height <= 1)
+        return;
+    LinearLevel linear = toLinear(levels.back(), nrComponents, srgb);
+    while (linear.width > 1 || linear.height > 1)
+    {
+        linear = downsample(linear);
+        levels.push_back(fromLinear(linear, nrComponents, srgb));
+    }
+}
+
+#endif
@@ -9,27 +9,78 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/DefaultIOSystem.h>
+#include <assimp/MemoryIOWrapper.h>
 
+#include <learnopengl/asset_pack.h>
+#include <learnopengl/frustum.h>
 #include <learnopengl/mesh.h>
+#include <learnopengl/mesh_cache.h>
+#include <learnopengl/mesh_optimizer.h>
+#include <learnopengl/mesh_simplify.h>
 #include <learnopengl/shader.h>
+#include <learnopengl/texture_cache.h>
+#include <learnopengl/trace.h>
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstring>
 #include <map>
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+// post-processing applied by Assimp on import, also part of the mesh cache key
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
 
 
+// lets Assimp read the model and everything it references (.mtl files and such) straight out of the asset
+// pack, anything that isn't packed goes through the regular file system. Remembers every file the import
+// looked for or read, the mesh cache is only good as long as they don't change.
+class AssetPackIOSystem : public Assimp::DefaultIOSystem
+{
+public:
+    using Assimp::DefaultIOSystem::Exists;
+    using Assimp::DefaultIOSystem::Open;
+
+    // in the order they were first asked for
+    vector<string> files() const { return requested; }
+
+    bool Exists(const char *pFile) const override
+    {
+        record(pFile);
+        return assetPack().contains(pFile) || Assimp::DefaultIOSystem::Exists(pFile);
+    }
+
+    Assimp::IOStream *Open(const char *pFile, const char *pMode = "rb") override
+    {
+        const unsigned char *data;
+        size_t size;
+        if (strchr(pMode, 'w') == nullptr)
+        {
+            record(pFile);
+            if (assetPack().find(pFile, data, size))
+                return new Assimp::MemoryIOStream(data, size);
+        }
+        return Assimp::DefaultIOSystem::Open(pFile, pMode);
+    }
+
+private:
+    mutable vector<string> requested;
+
+    void record(const char *pFile) const
+    {
+        if (find(requested.begin(), requested.end(), pFile) == requested.end())
+            requested.push_back(pFile);
+    }
+};
 
 class Model
 {
 public:
     // model data
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
@@ -40,11 +91,105 @@ public:
         loadModel(path);
     }
 
-    // draws the model, and thus all its meshes
+    // draws the model, and thus all its meshes. Meshes that share an arena block and a material go out
+    // together in one multi-draw (see MultiDraw), with the material bound once.
     void Draw(Shader &shader)
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        drawBatches(shader, nullptr);
+    }
+
+    // draws a copy of the model for every matrix, batched like Draw with every draw instanced.
+    // The shader gets instanced set for the draws and reads the matrices per instance (model_lighting.vs does).
+    void DrawInstanced(Shader &shader, const glm::mat4 *models, unsigned int count)
+    {
+        if (count == 0)
+            return;
+        instances.update(models, count, GL_STREAM_DRAW);
+        shader.setBool("instanced", true);
+        drawBatches(shader, &instances);
+        shader.setBool("instanced", false);
+    }
+
+    void DrawInstanced(Shader &shader, const vector<glm::mat4> &models)
+    {
+        DrawInstanced(shader, models.data(), models.size());
+    }
+
+    // picks the level of detail of every mesh for the following Draw calls: the coarsest one whose error,
+    // projected at the model's closest distance to the camera, stays under maxPixelError pixels. Below a pixel
+    // the switch between levels isn't visible, so there's no popping to hide.
+    void SelectLod(const glm::mat4 &model, const glm::mat4 &view, const glm::mat4 &projection, float viewportHeight,
+                   float maxPixelError = 1.0f)
+    {
+        SelectLod(&model, 1, view, projection, viewportHeight, maxPixelError);
+    }
+
+    // the same for the copies of a DrawInstanced: they share a level, the one the closest copy needs
+    void SelectLod(const glm::mat4 *models, unsigned int count, const glm::mat4 &view, const glm::mat4 &projection,
+                   float viewportHeight, float maxPixelError = 1.0f)
+    {
+        if (meshes.empty())
+            return;
+        glm::vec3 boundsMin, boundsMax;
+        Bounds(boundsMin, boundsMax);
+
+        // pixels per object space unit of the copy that needs the most detail
+        bool fullDetail = false;
+        float pixelsPerObjectUnit = 0.0f;
+        for (unsigned int i = 0; i < count && !fullDetail; i++)
+        {
+            const glm::mat4 &model = models[i];
+            // bounding sphere in view space, object space errors scale with the largest axis scale
+            glm::vec4 center = view * model * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f);
+            float scale = max(glm::length(glm::vec3(model[0])), max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+            float distance = -center.z - radius;
+
+            // pixels per world unit at that distance; inside the sphere everything gets full detail
+            if (distance <= 0.0f)
+                fullDetail = true;
+            else
+                pixelsPerObjectUnit = max(pixelsPerObjectUnit, scale * projection[1][1] * viewportHeight * 0.5f / distance);
+        }
+        for (Mesh &mesh : meshes)
+        {
+            mesh.lod = 0;
+            if (fullDetail)
+                continue;
+            for (unsigned int l = 1; l < mesh.lods.size(); l++)
+                if (mesh.lods[l].error * pixelsPerObjectUnit <= maxPixelError)
+                    mesh.lod = l;
+        }
+    }
+
+    // the AABB around all the meshes, in object space
+    void Bounds(glm::vec3 &boundsMin, glm::vec3 &boundsMax) const
+    {
+        boundsMin = boundsMax = glm::vec3(0.0f);
+        if (meshes.empty())
+            return;
+        boundsMin = meshes[0].boundsMin;
+        boundsMax = meshes[0].boundsMax;
+        for (const Mesh &mesh : meshes)
+        {
+            boundsMin = glm::min(boundsMin, mesh.boundsMin);
+            boundsMax = glm::max(boundsMax, mesh.boundsMax);
+        }
+    }
+
+    // marks the meshes none of the copies has on screen, Draw and DrawInstanced skip them until the next Cull.
+    // Every mesh of every copy goes through one cullSpheres call.
+    void Cull(const Frustum &frustum, const glm::mat4 *models, unsigned int count)
+    {
+        cullBounds.clear();
+        for (unsigned int i = 0; i < count; i++)
+            for (const Mesh &mesh : meshes)
+                cullBounds.add(models[i], mesh.boundsCenter, mesh.boundsRadius);
+        cullSpheres(frustum, cullBounds, cullVisible);
+        for (Mesh &mesh : meshes)
+            mesh.visible = false;
+        for (unsigned int index : cullVisible)
+            meshes[index % meshes.size()].visible = true;
     }
 
     void SetShaderTextureNamePrefix(std::string prefix) {
@@ -53,23 +198,116 @@ public:
         }
     }
 private:
+    // the matrices of the last DrawInstanced
+    InstanceBuffer instances;
+    // scratch space for Cull and drawBatches, kept around between frames
+    SphereSet cullBounds;
+    vector<unsigned int> cullVisible;
+    vector<char> batched;
+    vector<MultiDrawRange> batchRanges;
+    vector<glm::vec3> batchMins, batchExtents;
+
+    void drawBatches(Shader &shader, const InstanceBuffer *instanced)
+    {
+        batched.assign(meshes.size(), 0);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            Mesh &first = meshes[i];
+            if (batched[i] || !first.visible || !first.Ready())
+                continue;
+
+            // every mesh still to be drawn that can go with this one
+            batchRanges.clear();
+            batchMins.clear();
+            batchExtents.clear();
+            for (unsigned int j = i; j < meshes.size(); j++)
+            {
+                Mesh &mesh = meshes[j];
+                if (batched[j] || !mesh.visible || !mesh.SharesBatch(first) || !mesh.Ready())
+                    continue;
+                batched[j] = 1;
+                batchRanges.push_back(mesh.DrawRange());
+                batchMins.push_back(mesh.boundsMin);
+                batchExtents.push_back(mesh.boundsMax - mesh.boundsMin);
+            }
+
+            first.BindMaterial(shader);
+            GeometryArena &arena = meshArena(first.packed, first.indexType);
+            if (instanced)
+                arena.attachInstances(first.range, *instanced, 5);
+            else
+                glBindVertexArray(arena.vertexArray(first.range));
+            // the per draw bounds only have room for so many draws
+            for (unsigned int start = 0; start < batchRanges.size(); start += MULTI_DRAW_MAX)
+            {
+                unsigned int count = min<size_t>(MULTI_DRAW_MAX, batchRanges.size() - start);
+                if (first.packed)
+                    setPackedBounds(shader, &batchMins[start], &batchExtents[start], count);
+                multiDraw().draw(shader, first.indexType, &batchRanges[start], count, instanced ? instanced->count : 0, first.packed);
+            }
+            glBindVertexArray(0);
+            first.UnbindMaterial(shader);
+        }
+    }
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
     {
+        TRACE_SCOPE_DETAIL("Model", path.c_str());
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // try the binary mesh cache first, on a hit Assimp doesn't run at all
+        string cachePath = path + ".meshcache";
+        bool sourceFound;
+        uint64_t sourceHash = meshCacheKey(path, MODEL_IMPORT_FLAGS, sourceFound);
+        if (sourceFound && loadFromCache(cachePath, sourceHash))
+            return;
+
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        AssetPackIOSystem *files = new AssetPackIOSystem();
+        importer.SetIOHandler(files); // owned by the importer
+        const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        // the source itself is in sourceHash already
+        vector<string> dependencies = files->files();
+        dependencies.erase(remove(dependencies.begin(), dependencies.end(), path), dependencies.end());
+        if (sourceFound && !writeMeshCache(cachePath, sourceHash, dependencies, MODEL_IMPORT_FLAGS, meshes))
+            cout << "WARNING::MESH_CACHE:: failed to write " << cachePath << endl;
+
+        // everything's on the GPU (or in the upload queue's own copy) and in the cache by now
+        if (meshGeometryRelease())
+            for (Mesh &mesh : meshes)
+                mesh.ReleaseGeometry();
+    }
+
+    // builds the meshes straight from a memory-mapped cache file, returns false if the cache is missing or stale
+    bool loadFromCache(const string &cachePath, uint64_t sourceHash)
+    {
+        MeshCacheReader cache;
+        if (!cache.open(cachePath, sourceHash, MODEL_IMPORT_FLAGS))
+            return false;
+
+        for (unsigned int i = 0; i < cache.meshCount(); i++)
+        {
+            const MeshCacheEntry &entry = cache.entry(i);
+            vector<Texture> textures;
+            for (unsigned int t = entry.firstTexture; t < entry.firstTexture + entry.textureCount; t++)
+                textures.push_back(loadMaterialTexture(cache.texturePath(t), cache.textureType(t)));
+            meshes.push_back(Mesh(cache.vertices(entry), entry.vertexCount, cache.indices(entry), entry.indexCount, move(textures),
+                                  cache.lods(entry)));
+        }
+        return true;
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -81,7 +319,7 @@ private:
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            processMesh(mesh, scene);
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
@@ -91,7 +329,8 @@ private:
 
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // appends the mesh to meshes, as several meshes when it gets split up for 16-bit indices
+    void processMesh(aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
         vector<Vertex> vertices;
@@ -178,8 +417,25 @@ private:
 
 
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // weld, reorder for the vertex cache/overdraw/fetch; the mesh cache stores the result
+        optimizeMesh(vertices, indices, mesh->mName.C_Str());
+
+        // meshes too big for 16-bit indices are cut into chunks that fit, if that's worth the seam vertices
+        vector<vector<Vertex>> chunkVertices;
+        vector<vector<unsigned int>> chunkIndices;
+        size_t vertexSize = meshVertexPacking() ? sizeof(PackedVertex) : sizeof(Vertex);
+        if (!splitForShortIndices(vertices, indices, vertexSize, chunkVertices, chunkIndices))
+        {
+            chunkVertices.push_back(move(vertices));
+            chunkIndices.push_back(move(indices));
+        }
+
+        // create the mesh objects, each with its chain of simplified LODs appended to its indices
+        for (unsigned int i = 0; i < chunkVertices.size(); i++)
+        {
+            vector<MeshLod> lods = generateLods(chunkVertices[i], chunkIndices[i], mesh->mName.C_Str());
+            meshes.push_back(Mesh(move(chunkVertices[i]), move(chunkIndices[i]), textures, move(lods)));
+        }
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -191,69 +447,22 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back(loadMaterialTexture(str.C_Str(), typeName));
         }
         return textures;
     }
-};
-
-
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
-{
-    string filename = string(path);
-    filename = directory + '/' + filename;
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
+    // loads a single material texture through the process-wide TextureCache, so models (and main()) using the
+    // same image share one GL texture
+    Texture loadMaterialTexture(const string &path, const string &typeName)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        Texture texture;
+        // only diffuse maps hold colors, specular and normal maps are filtered as plain data
+        texture.handle = textureCache().load2D(this->directory + '/' + path, typeName == "texture_diffuse");
+        texture.id = texture.handle->id;
+        texture.type = typeName;
+        texture.path = path;
+        return texture;
     }
-
-    return textureID;
-}
+};
 #endif
@@ -0,0 +1,169 @@
+#ifndef MULTI_DRAW_H
+#define MULTI_DRAW_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// glad is generated for core 3.3, indirect draws are GL 4.3 / GL_ARB_multi_draw_indirect
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+// draws per multi-draw call, the size of the per draw arrays a shader indexes with DRAW_ID
+// (MAX_DRAWS in model_lighting.vs)
+const unsigned int MULTI_DRAW_MAX = 64;
+
+// one draw of a multi-draw: a range of the bound index buffer, its indices offset by baseVertex
+struct MultiDrawRange {
+    GLsizei count;
+    unsigned int firstIndex;
+    GLint baseVertex;
+};
+
+// laid out like GL wants it in the indirect buffer
+struct DrawElementsIndirectCommand {
+    unsigned int count;
+    unsigned int instanceCount;
+    unsigned int firstIndex;
+    GLint baseVertex;
+    unsigned int baseInstance;
+};
+
+// Submits a list of ranges of the bound VAO's index buffer in as few calls as the context allows:
+// glMultiDrawElementsIndirect on GL 4.3, glMultiDrawElementsBaseVertex otherwise (that one has no instanced
+// form, so instanced lists fall back to a draw per range).
+// Per draw data (the bounds of packed meshes, say) is read by the shader at
+//   #define DRAW_ID (drawIDBase + gl_DrawIDARB)
+// which needs GL_ARB_shader_draw_parameters. Without it a list that has per draw data goes out one draw at a
+// time with drawIDBase set for each, see model_lighting.vs.
+// Only used on the GL thread.
+class MultiDraw
+{
+public:
+    // gl_DrawIDARB counts the draws of a multi-draw
+    bool drawIDs()
+    {
+        if (!initialized)
+            initialize();
+        return shaderDrawParameters;
+    }
+
+    bool indirect()
+    {
+        if (!initialized)
+            initialize();
+        return multiDrawElementsIndirect != nullptr;
+    }
+
+    // draws ranges[0..count) of the bound VAO, instanceCount copies of each when it isn't 0. perDrawData says
+    // the shader tells the draws apart by DRAW_ID; count is at most MULTI_DRAW_MAX then.
+    void draw(Shader &shader, GLenum indexType, const MultiDrawRange *ranges, unsigned int count,
+              unsigned int instanceCount, bool perDrawData)
+    {
+        if (count == 0)
+            return;
+        if (!initialized)
+            initialize();
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+
+        if (count > 1 && (!perDrawData || shaderDrawParameters))
+        {
+            if (multiDrawElementsIndirect)
+            {
+                commands.resize(count);
+                for (unsigned int i = 0; i < count; i++)
+                    commands[i] = DrawElementsIndirectCommand{(unsigned int)ranges[i].count, max(instanceCount, 1u),
+                                                              ranges[i].firstIndex, ranges[i].baseVertex, 0};
+                if (!indirectBuffer)
+                    glGenBuffers(1, &indirectBuffer);
+                // respecified every time, like the instance buffers, so the previous list can still be in flight
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+                glBufferData(GL_DRAW_INDIRECT_BUFFER, count * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+                multiDrawElementsIndirect(GL_TRIANGLES, indexType, nullptr, count, 0);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+                return;
+            }
+            if (instanceCount == 0)
+            {
+                counts.resize(count);
+                offsets.resize(count);
+                baseVertices.resize(count);
+                for (unsigned int i = 0; i < count; i++)
+                {
+                    counts[i] = ranges[i].count;
+                    offsets[i] = (const void *)(ranges[i].firstIndex * indexSize);
+                    baseVertices[i] = ranges[i].baseVertex;
+                }
+                glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), indexType, offsets.data(), count, baseVertices.data());
+                return;
+            }
+        }
+
+        // a draw per range, the shader learns its index from drawIDBase
+        for (unsigned int i = 0; i < count; i++)
+        {
+            if (perDrawData)
+                shader.setInt("drawIDBase", i);
+            const void *offset = (const void *)(ranges[i].firstIndex * indexSize);
+            if (instanceCount > 0)
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, ranges[i].count, indexType, offset, instanceCount, ranges[i].baseVertex);
+            else
+                glDrawElementsBaseVertex(GL_TRIANGLES, ranges[i].count, indexType, offset, ranges[i].baseVertex);
+        }
+        if (perDrawData && count > 1)
+            shader.setInt("drawIDBase", 0);
+    }
+
+private:
+    typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+
+    bool initialized = false;
+    bool shaderDrawParameters = false;
+    MultiDrawElementsIndirectProc multiDrawElementsIndirect = nullptr;
+    unsigned int indirectBuffer = 0;
+    // scratch space for the calls, kept around between frames
+    vector<DrawElementsIndirectCommand> commands;
+    vector<GLsizei> counts;
+    vector<const void *> offsets;
+    vector<GLint> baseVertices;
+
+    void initialize()
+    {
+        initialized = true;
+
+        GLint major = 0, minor = 0, count = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool multiDrawIndirect = major * 10 + minor >= 43;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+            if (!name)
+                continue;
+            // the shaders are #version 330, gl_DrawIDARB is only there with the extension (even on GL 4.6)
+            if (strcmp(name, "GL_ARB_shader_draw_parameters") == 0)
+                shaderDrawParameters = true;
+            else if (strcmp(name, "GL_ARB_multi_draw_indirect") == 0)
+                multiDrawIndirect = true;
+        }
+        if (multiDrawIndirect)
+            multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)glfwGetProcAddress("glMultiDrawElementsIndirect");
+    }
+};
+
+inline MultiDraw &multiDraw()
+{
+    static MultiDraw m;
+    return m;
+}
+
+#endif
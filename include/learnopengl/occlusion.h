@@ -0,0 +1,309 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/frustum.h>
+#include <learnopengl/thread_pool.h>
+#include <learnopengl/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+// horizontal bands the depth buffer is split into, each rasterized by one thread
+const unsigned int OCCLUSION_BANDS = 4;
+
+// Software occlusion culling: the occluders are rasterized on the CPU into a small depth buffer every frame,
+// then reduced into a hierarchical-Z pyramid whose texels hold the farthest depth of what they cover. An
+// occludee's box is hidden when its nearest point is behind the farthest occluder depth everywhere under its
+// screen rectangle, so hidden objects are dropped before they're submitted, without asking the GPU.
+// Depths are window space, [0, 1] from the near to the far plane. Occluders that cross the near plane are
+// left out and boxes that cross it are always visible, so the answer errs on the side of drawing.
+// render() and visible() belong to one thread, the rows are filled on the workerPool() and on that thread.
+class OcclusionBuffer
+{
+public:
+    // the width is rounded up to a multiple of 4, the rasterizer fills 4 pixels at a time
+    explicit OcclusionBuffer(unsigned int width = 256, unsigned int height = 192)
+        : width((max(width, 4u) + 3) & ~3u), height(max(height, 1u))
+    {
+        unsigned int w = this->width, h = this->height;
+        levels.push_back(Level{w, h, vector<float>(w * h, 1.0f)});
+        while (w > 1 || h > 1)
+        {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            levels.push_back(Level{w, h, vector<float>(w * h, 1.0f)});
+        }
+    }
+
+    // helpers still queued from the last render() would find the buffer gone
+    ~OcclusionBuffer()
+    {
+        unique_lock<mutex> lock(bandMutex);
+        bandsFinished.wait(lock, [this] { return helpersPending == 0; });
+    }
+
+    OcclusionBuffer(const OcclusionBuffer &) = delete;
+    OcclusionBuffer &operator=(const OcclusionBuffer &) = delete;
+
+    // world space triangles, three vertices each, drawn by every render() until replaced
+    void setOccluders(vector<glm::vec3> triangles)
+    {
+        occluders = move(triangles);
+    }
+
+    // redraws the occluders as seen through projection * view and rebuilds the pyramid
+    void render(const glm::mat4 &viewProjection)
+    {
+        TRACE_SCOPE("occlusion raster");
+        this->viewProjection = viewProjection;
+        setupTriangles();
+
+        // bands are handed out by nextBand, to the helpers and to this thread alike, so nothing waits on a
+        // helper that's stuck behind other jobs. A helper that only starts after the bands are gone does nothing.
+        unsigned int helpers = min(workerPool().size(), OCCLUSION_BANDS - 1);
+        {
+            lock_guard<mutex> lock(bandMutex);
+            bandsDone = 0;
+            helpersPending += helpers;
+        }
+        nextBand = 0;
+        for (unsigned int i = 0; i < helpers; i++)
+            workerPool().enqueue([this] {
+                rasterizeBands();
+                lock_guard<mutex> lock(bandMutex);
+                if (--helpersPending == 0)
+                    bandsFinished.notify_all();
+            });
+        rasterizeBands();
+        {
+            unique_lock<mutex> lock(bandMutex);
+            bandsFinished.wait(lock, [this] { return bandsDone == OCCLUSION_BANDS; });
+        }
+
+        buildPyramid();
+    }
+
+    // whether anything of a world space box might be in front of the occluders of the last render()
+    bool visible(const Aabb &box) const
+    {
+        glm::vec2 screenMin(FLT_MAX), screenMax(-FLT_MAX);
+        float nearest = FLT_MAX;
+        for (unsigned int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 position(corner & 1 ? box.boundsMax.x : box.boundsMin.x,
+                               corner & 2 ? box.boundsMax.y : box.boundsMin.y,
+                               corner & 4 ? box.boundsMax.z : box.boundsMin.z);
+            glm::vec4 clip = viewProjection * glm::vec4(position, 1.0f);
+            if (clip.z < -clip.w || clip.w <= 0.0f)
+                return true;
+            glm::vec3 window = toWindow(clip);
+            screenMin = glm::min(screenMin, glm::vec2(window));
+            screenMax = glm::max(screenMax, glm::vec2(window));
+            nearest = min(nearest, window.z);
+        }
+
+        // the pixels the rectangle touches, off screen ones are the frustum's business
+        int x0 = max((int)floor(screenMin.x), 0), x1 = min((int)floor(screenMax.x), (int)width - 1);
+        int y0 = max((int)floor(screenMin.y), 0), y1 = min((int)floor(screenMax.y), (int)height - 1);
+        if (x0 > x1 || y0 > y1)
+            return true;
+
+        // the finest level where the rectangle spans at most 4x4 texels, coarser ones reach too far past its edges
+        unsigned int level = 0;
+        while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3))
+            level++;
+        const Level &l = levels[level];
+        for (int y = y0 >> level; y <= (y1 >> level); y++)
+            for (int x = x0 >> level; x <= (x1 >> level); x++)
+                if (l.depth[y * l.width + x] >= nearest)
+                    return true;
+        return false;
+    }
+
+private:
+    struct Level {
+        unsigned int width, height;
+        vector<float> depth;
+    };
+
+    // a triangle ready for the rasterizer: its edge functions E(x, y) = a * x + b * y + c, all >= 0 inside,
+    // its depth as a plane over the screen and the pixels it can cover
+    struct ScreenTriangle {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthA, depthB, depthC;
+        int minX, maxX, minY, maxY;
+    };
+
+    const unsigned int width, height;
+    vector<Level> levels;       // levels[0] is the depth buffer itself
+    vector<glm::vec3> occluders;
+    vector<ScreenTriangle> triangles;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+
+    atomic<unsigned int> nextBand{OCCLUSION_BANDS};
+    mutex bandMutex;
+    condition_variable bandsFinished;
+    unsigned int bandsDone = 0;
+    unsigned int helpersPending = 0;
+
+    glm::vec3 toWindow(const glm::vec4 &clip) const
+    {
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+    }
+
+    void setupTriangles()
+    {
+        triangles.clear();
+        for (size_t i = 0; i + 2 < occluders.size(); i += 3)
+        {
+            glm::vec3 v[3];
+            bool clipped = false;
+            for (unsigned int j = 0; j < 3 && !clipped; j++)
+            {
+                glm::vec4 clip = viewProjection * glm::vec4(occluders[i + j], 1.0f);
+                clipped = clip.z < -clip.w || clip.w <= 0.0f;
+                if (!clipped)
+                    v[j] = toWindow(clip);
+            }
+            if (clipped)
+                continue;
+
+            // both windings, counter-clockwise from here on
+            float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+            if (fabs(area) < 1e-6f)
+                continue;
+            if (area < 0.0f)
+            {
+                swap(v[1], v[2]);
+                area = -area;
+            }
+
+            ScreenTriangle t;
+            t.minX = max((int)floor(min(v[0].x, min(v[1].x, v[2].x))), 0);
+            t.maxX = min((int)ceil(max(v[0].x, max(v[1].x, v[2].x))), (int)width - 1);
+            t.minY = max((int)floor(min(v[0].y, min(v[1].y, v[2].y))), 0);
+            t.maxY = min((int)ceil(max(v[0].y, max(v[1].y, v[2].y))), (int)height - 1);
+            if (t.minX > t.maxX || t.minY > t.maxY)
+                continue;
+
+            // edge k is opposite vertex k, its function over the area is that vertex's barycentric weight
+            t.depthA = t.depthB = t.depthC = 0.0f;
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                const glm::vec3 &a = v[(k + 1) % 3], &b = v[(k + 2) % 3];
+                t.edgeA[k] = a.y - b.y;
+                t.edgeB[k] = b.x - a.x;
+                t.edgeC[k] = a.x * b.y - a.y * b.x;
+                t.depthA += t.edgeA[k] / area * v[k].z;
+                t.depthB += t.edgeB[k] / area * v[k].z;
+                t.depthC += t.edgeC[k] / area * v[k].z;
+            }
+            triangles.push_back(t);
+        }
+    }
+
+    void rasterizeBands()
+    {
+        for (unsigned int band; (band = nextBand.fetch_add(1)) < OCCLUSION_BANDS;)
+        {
+            rasterizeBand(band);
+            lock_guard<mutex> lock(bandMutex);
+            if (++bandsDone == OCCLUSION_BANDS)
+                bandsFinished.notify_all();
+        }
+    }
+
+    // clears a band's rows and draws every triangle that reaches into them, keeping the nearest depth
+    void rasterizeBand(unsigned int band)
+    {
+        const int bandHeight = (height + OCCLUSION_BANDS - 1) / OCCLUSION_BANDS;
+        const int firstRow = band * bandHeight, lastRow = min(firstRow + bandHeight, (int)height) - 1;
+        if (firstRow > lastRow)
+            return;
+        float *depth = levels[0].depth.data();
+        fill(depth + firstRow * width, depth + (lastRow + 1) * width, 1.0f);
+
+        for (const ScreenTriangle &t : triangles)
+        {
+            const int startX = t.minX & ~3;
+            for (int y = max(t.minY, firstRow); y <= min(t.maxY, lastRow); y++)
+            {
+                const float py = y + 0.5f;
+                float *row = depth + y * width;
+#if defined(__SSE__) || defined(_M_X64)
+                // 4 pixels per step, the edge and depth values move along the row by 4 * a
+                const __m128 zero = _mm_setzero_ps();
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)startX), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+                __m128 e[3], step[3];
+                for (unsigned int k = 0; k < 3; k++)
+                {
+                    e[k] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.edgeA[k]), px), _mm_set1_ps(t.edgeB[k] * py + t.edgeC[k]));
+                    step[k] = _mm_set1_ps(t.edgeA[k] * 4.0f);
+                }
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.depthA), px), _mm_set1_ps(t.depthB * py + t.depthC));
+                const __m128 zStep = _mm_set1_ps(t.depthA * 4.0f);
+                for (int x = startX; x <= t.maxX; x += 4)
+                {
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e[0], zero), _mm_cmpge_ps(e[1], zero)),
+                                               _mm_cmpge_ps(e[2], zero));
+                    if (_mm_movemask_ps(inside))
+                    {
+                        __m128 stored = _mm_loadu_ps(row + x);
+                        __m128 nearer = _mm_min_ps(stored, z);
+                        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+                    }
+                    for (unsigned int k = 0; k < 3; k++)
+                        e[k] = _mm_add_ps(e[k], step[k]);
+                    z = _mm_add_ps(z, zStep);
+                }
+#else
+                for (int x = startX; x <= t.maxX; x++)
+                {
+                    const float px = x + 0.5f;
+                    bool inside = true;
+                    for (unsigned int k = 0; k < 3; k++)
+                        inside = inside && t.edgeA[k] * px + t.edgeB[k] * py + t.edgeC[k] >= 0.0f;
+                    if (inside)
+                        row[x] = min(row[x], t.depthA * px + t.depthB * py + t.depthC);
+                }
+#endif
+            }
+        }
+    }
+
+    // every texel keeps the farthest of the up to 2x2 below it
+    void buildPyramid()
+    {
+        TRACE_SCOPE("occlusion pyramid");
+        for (size_t i = 1; i < levels.size(); i++)
+        {
+            const Level &below = levels[i - 1];
+            Level &level = levels[i];
+            for (unsigned int y = 0; y < level.height; y++)
+            {
+                unsigned int y0 = 2 * y, y1 = min(2 * y + 1, below.height - 1);
+                for (unsigned int x = 0; x < level.width; x++)
+                {
+                    unsigned int x0 = 2 * x, x1 = min(2 * x + 1, below.width - 1);
+                    level.depth[y * level.width + x] = max(max(below.depth[y0 * below.width + x0], below.depth[y0 * below.width + x1]),
+                                                           max(below.depth[y1 * below.width + x0], below.depth[y1 * below.width + x1]));
+                }
+            }
+        }
+    }
+};
+
+#endif
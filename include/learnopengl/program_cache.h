@@ -0,0 +1,201 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <learnopengl/hash.h>
+#include <learnopengl/mapped_file.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+// glad is generated for core 3.3, program binaries are GL 4.1 / GL_ARB_get_program_binary
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+const char PROGRAM_CACHE_MAGIC[8] = {'R', 'G', 'P', 'R', 'O', 'G', '1', '\0'};
+
+// Persistent cache of linked shader programs. After a program is linked from source its driver binary
+// (glGetProgramBinary) is written to <directory>/<key>.bin, and the next run creates the program from it with
+// glProgramBinary instead of compiling. The key hashes the shader sources together with the GL vendor, renderer
+// and version strings, so a driver update or an edited shader simply misses. Drivers may still reject a binary
+// (they're free to), in which case the program is compiled like before and the entry rewritten.
+// Only used on the GL thread.
+class ProgramCache
+{
+public:
+    // where the binaries go, created on the first store
+    std::string directory = "shader_cache";
+
+    // false when the context can't hand out program binaries (no GL 4.1 or extension, or no binary formats)
+    bool available()
+    {
+        if (!initialized)
+            initialize();
+        return getProgramBinary != nullptr;
+    }
+
+    // the cache key for a program made of these sources (stage order, laid out like glShaderSource takes them)
+    uint64_t key(const char *const *sources, const GLint *lengths, int count)
+    {
+        if (!initialized)
+            initialize();
+        uint64_t hash = fnv1a64(driver);
+        for (int i = 0; i < count; i++)
+        {
+            uint64_t length = lengths[i];
+            hash = fnv1a64(&length, sizeof(length), hash);
+            hash = fnv1a64(sources[i], lengths[i], hash);
+        }
+        return hash;
+    }
+
+    // tries to create the program from the cache, returns false on a miss or when the driver rejects it
+    bool load(unsigned int program, uint64_t key)
+    {
+        if (!available())
+            return false;
+        MappedFile file(path(key));
+        if (!file.isOpen() || file.size() < sizeof(Header))
+            return false;
+        const Header *header = reinterpret_cast<const Header *>(file.data());
+        if (memcmp(header->magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0 || header->key != key
+            || header->length != file.size() - sizeof(Header))
+            return false;
+
+        programBinary(program, header->format, file.data() + sizeof(Header), header->length);
+        GLint success = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            std::cout << "WARNING::PROGRAM_CACHE:: driver rejected the cached binary " << path(key) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // before glLinkProgram, so the driver keeps the binary around for store()
+    void prepare(unsigned int program)
+    {
+        if (available())
+            programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // writes the binary of a successfully linked program
+    void store(unsigned int program, uint64_t key)
+    {
+        if (!available())
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<unsigned char> binary(length);
+        Header header = {};
+        memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+        header.key = key;
+        getProgramBinary(program, length, &length, &header.format, binary.data());
+        header.length = length;
+
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+            return;
+        std::string finalPath = path(key);
+        std::string tmpPath = finalPath + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(binary.data()), header.length);
+            if (!out)
+            {
+                out.close();
+                remove(tmpPath.c_str());
+                return;
+            }
+        }
+        rename(tmpPath.c_str(), finalPath.c_str());
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t key;
+        uint32_t format;
+        uint32_t length;
+    };
+
+    typedef void (APIENTRYP GetProgramBinaryProc)(GLuint, GLsizei, GLsizei *, GLenum *, void *);
+    typedef void (APIENTRYP ProgramBinaryProc)(GLuint, GLenum, const void *, GLsizei);
+    typedef void (APIENTRYP ProgramParameteriProc)(GLuint, GLenum, GLint);
+
+    bool initialized = false;
+    std::string driver;
+    GetProgramBinaryProc getProgramBinary = nullptr;
+    ProgramBinaryProc programBinary = nullptr;
+    ProgramParameteriProc programParameteri = nullptr;
+
+    void initialize()
+    {
+        initialized = true;
+        const char *strings[3] = {reinterpret_cast<const char *>(glGetString(GL_VENDOR)),
+                                  reinterpret_cast<const char *>(glGetString(GL_RENDERER)),
+                                  reinterpret_cast<const char *>(glGetString(GL_VERSION))};
+        for (const char *string : strings)
+            driver += std::string(string ? string : "") + '\n';
+
+        GLint major = 0, minor = 0, count = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool supported = major * 10 + minor >= 41;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count && !supported; i++)
+        {
+            const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+            supported = name && strcmp(name, "GL_ARB_get_program_binary") == 0;
+        }
+        if (!supported)
+            return;
+
+        // a driver may support the calls but offer no formats to save in
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats <= 0)
+            return;
+
+        programBinary = (ProgramBinaryProc)glfwGetProcAddress("glProgramBinary");
+        programParameteri = (ProgramParameteriProc)glfwGetProcAddress("glProgramParameteri");
+        getProgramBinary = (GetProgramBinaryProc)glfwGetProcAddress("glGetProgramBinary");
+        if (!programBinary || !programParameteri)
+            getProgramBinary = nullptr;
+    }
+
+    std::string path(uint64_t key) const
+    {
+        char name[17];
+        snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+        return directory + '/' + name + ".bin";
+    }
+};
+
+inline ProgramCache &programCache()
+{
+    static ProgramCache cache;
+    return cache;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <functional>
+#include <vector>
+using namespace std;
+
+// passes run in this order, each with its own depth state
+enum RenderPass {
+    RENDER_PASS_OPAQUE = 0,     // depth test and writes, front to back
+    RENDER_PASS_SKY = 1         // drawn behind everything: depth test at LEQUAL, no writes
+};
+
+// A draw the frame repeats: the state it needs and the call itself. Commands are set up once and submitted
+// every frame, so the frame loop allocates nothing. The queue binds the program, VAO and texture before
+// draw() runs; a command that binds its own (a Model with its materials) leaves the field at 0.
+struct RenderCommand {
+    RenderPass pass;
+    Shader *shader;
+    unsigned int vertexArray;
+    unsigned int textureUnit;
+    GLenum textureTarget;
+    unsigned int texture;
+    function<void()> draw;
+};
+
+// Collects the frame's draws with a packed 64-bit sort key, radix sorts them and submits them in that order:
+//   pass (4 bits) | program (12) | texture (16) | VAO (12) | depth (20)
+// Draws sharing a program and texture end up next to each other and every state change happens once per
+// frame at most; within the same state opaque draws go front to back, so early-Z rejects what's hidden.
+// GL names are masked into their fields, two names that alias only cost a redundant bind, never a wrong one.
+// Programs get a per frame callback (view, projection, lights) the first time they're bound in a frame.
+// Only used on the GL thread.
+class RenderQueue
+{
+public:
+    // depths are quantized over [0, farPlane], the projection's far plane
+    explicit RenderQueue(float farPlane = 100.0f) : farPlane(farPlane) {}
+
+    // runs with the shader bound, before the first command using it each frame
+    void perFrame(Shader &shader, function<void()> setup)
+    {
+        programs.push_back(ProgramSetup{&shader, move(setup), false});
+    }
+
+    // depth is the command's distance in front of the camera (see viewDepth), for the nearest copy if instanced
+    void submit(const RenderCommand &command, float depth)
+    {
+        uint64_t quantized = (uint64_t)(glm::clamp(depth / farPlane, 0.0f, 1.0f) * DEPTH_MASK);
+        uint64_t key = (uint64_t)(command.pass & 0xF) << 60
+                     | (uint64_t)(command.shader->ID & 0xFFF) << 48
+                     | (uint64_t)(command.texture & 0xFFFF) << 32
+                     | (uint64_t)(command.vertexArray & 0xFFF) << 20
+                     | quantized;
+        entries.push_back(SortEntry{key, (uint32_t)commands.size()});
+        commands.push_back(&command);
+    }
+
+    // sorts and draws everything submitted since the last flush, leaving the default depth state and no
+    // VAO bound
+    void flush()
+    {
+        radixSort(entries, scratch);
+
+        unsigned int program = 0, vertexArray = UNKNOWN, texture = UNKNOWN, textureUnit = 0;
+        GLenum textureTarget = GL_NONE;
+        int pass = -1;
+        for (const SortEntry &entry : entries)
+        {
+            const RenderCommand &command = *commands[entry.index];
+            if (command.pass != pass)
+            {
+                pass = command.pass;
+                glDepthMask(pass == RENDER_PASS_SKY ? GL_FALSE : GL_TRUE);
+                glDepthFunc(pass == RENDER_PASS_SKY ? GL_LEQUAL : GL_LESS);
+            }
+            if (command.shader->ID != program)
+            {
+                program = command.shader->ID;
+                command.shader->use();
+                for (ProgramSetup &setup : programs)
+                    if (setup.shader == command.shader && !setup.done)
+                    {
+                        setup.done = true;
+                        setup.setup();
+                    }
+            }
+            if (command.vertexArray && command.vertexArray != vertexArray)
+            {
+                vertexArray = command.vertexArray;
+                glBindVertexArray(vertexArray);
+            }
+            if (command.texture && (command.texture != texture || command.textureUnit != textureUnit
+                                    || command.textureTarget != textureTarget))
+            {
+                texture = command.texture;
+                textureUnit = command.textureUnit;
+                textureTarget = command.textureTarget;
+                glActiveTexture(GL_TEXTURE0 + textureUnit);
+                glBindTexture(textureTarget, texture);
+                glActiveTexture(GL_TEXTURE0);
+            }
+
+            command.draw();
+
+            // whatever the command bound itself isn't known anymore
+            if (!command.vertexArray)
+                vertexArray = UNKNOWN;
+            if (!command.texture)
+                texture = UNKNOWN;
+        }
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+
+        entries.clear();
+        commands.clear();
+        for (ProgramSetup &setup : programs)
+            setup.done = false;
+    }
+
+private:
+    static const uint64_t DEPTH_MASK = (1u << 20) - 1;
+    static const unsigned int UNKNOWN = ~0u;
+
+    struct SortEntry {
+        uint64_t key;
+        uint32_t index;     // into commands
+    };
+
+    struct ProgramSetup {
+        Shader *shader;
+        function<void()> setup;
+        bool done;
+    };
+
+    const float farPlane;
+    vector<SortEntry> entries, scratch;
+    vector<const RenderCommand *> commands;
+    vector<ProgramSetup> programs;
+
+    // LSD radix sort by key, a byte per pass. Stable, so equal keys keep their submission order. Passes where
+    // every key has the same byte (most of them, with few draws and sparse fields) are skipped.
+    static void radixSort(vector<SortEntry> &entries, vector<SortEntry> &scratch)
+    {
+        if (entries.size() < 2)
+            return;
+        scratch.resize(entries.size());
+        for (unsigned int shift = 0; shift < 64; shift += 8)
+        {
+            size_t counts[256] = {};
+            for (const SortEntry &entry : entries)
+                counts[(entry.key >> shift) & 0xFF]++;
+            if (counts[(entries[0].key >> shift) & 0xFF] == entries.size())
+                continue;
+            size_t offset = 0;
+            for (size_t &count : counts)
+            {
+                size_t c = count;
+                count = offset;
+                offset += c;
+            }
+            for (const SortEntry &entry : entries)
+                scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+            entries.swap(scratch);
+        }
+    }
+};
+
+// distance of a world space point in front of the camera
+inline float viewDepth(const glm::mat4 &view, const glm::vec3 &point)
+{
+    return -(view * glm::vec4(point, 1.0f)).z;
+}
+
+// the nearest of a group of instances
+inline float viewDepth(const glm::mat4 &view, const vector<glm::vec3> &points)
+{
+    float nearest = FLT_MAX;
+    for (const glm::vec3 &point : points)
+        nearest = min(nearest, viewDepth(view, point));
+    return nearest;
+}
+
+#endif
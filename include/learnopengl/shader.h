@@ -9,6 +9,10 @@
 #include <sstream>
 #include <iostream>
 #include <common.h>
+#include <learnopengl/asset_pack.h>
+#include <learnopengl/file_watcher.h>
+#include <learnopengl/program_cache.h>
+#include <learnopengl/trace.h>
 class Shader
 {
 public:
@@ -16,92 +20,38 @@ public:
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+        : vertexFile(vertexPath), fragmentFile(fragmentPath), geometryFile(geometryPath != nullptr ? geometryPath : "")
     {
-        std::string vertexPathString(vertexPath);
-        std::string fragmentPathString(fragmentPath);
-
-        vertexPath = vertexPathString.c_str();
-        fragmentPath= fragmentPathString.c_str();
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-            // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
-            {
-                std::string geometryPathString(geometryPath);
-                geometryPath = geometryPathString.c_str();
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure& e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-        }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
-        if(geometryPath != nullptr)
+        TRACE_SCOPE_DETAIL("Shader", vertexPath);
+        bool linked;
+        ID = build(vertexPath, fragmentPath, geometryPath, linked);
+    }
+    // rebuilds the program from its files. The new program only replaces the current one if it compiled and
+    // linked, otherwise the current one stays in use and the errors are printed.
+    // ------------------------------------------------------------------------
+    bool Reload()
+    {
+        bool linked;
+        unsigned int program = build(vertexFile.c_str(), fragmentFile.c_str(), geometryFile.empty() ? nullptr : geometryFile.c_str(), linked);
+        if (!linked)
         {
-            const char * gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            glDeleteProgram(program);
+            std::cout << "ERROR::SHADER::RELOAD_FAILED " << vertexFile << ", keeping the previous program" << std::endl;
+            return false;
         }
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if(geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if(geometryPath != nullptr)
-            glDeleteShader(geometry);
-
+        glDeleteProgram(ID);
+        ID = program;
+        return true;
+    }
+    // reloads the program whenever one of its files changes (once fileWatcher() has been started).
+    // the watcher keeps a pointer to this shader, so it must stay where it is.
+    // ------------------------------------------------------------------------
+    void WatchFiles()
+    {
+        fileWatcher().watch(vertexFile, [this] { Reload(); });
+        fileWatcher().watch(fragmentFile, [this] { Reload(); });
+        if (!geometryFile.empty())
+            fileWatcher().watch(geometryFile, [this] { Reload(); });
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -169,9 +119,86 @@ public:
     }
 
 private:
+    std::string vertexFile, fragmentFile, geometryFile;
+
+    // compiles and links a program from the files, or takes it from the program cache
+    // ------------------------------------------------------------------------
+    unsigned int build(const char* vertexPath, const char* fragmentPath, const char* geometryPath, bool &linked)
+    {
+        // 1. retrieve the vertex/fragment source code from filePath. The files are mapped (or found in the
+        // asset pack) and handed to GL from there, with their lengths, no copy into strings.
+        AssetFile vShaderFile(vertexPath);
+        AssetFile fShaderFile(fragmentPath);
+        AssetFile gShaderFile;
+        if (!vShaderFile.isOpen() || !fShaderFile.isOpen() || (geometryPath != nullptr && !gShaderFile.open(geometryPath)))
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        const char* vShaderCode = sourceOf(vShaderFile);
+        const char * fShaderCode = sourceOf(fShaderFile);
+        GLint vShaderLength = vShaderFile.size();
+        GLint fShaderLength = fShaderFile.size();
+        // 2. a program linked on an earlier run from the same sources (by the same driver) comes from the program cache
+        const char *sources[3] = {vShaderCode, fShaderCode, sourceOf(gShaderFile)};
+        GLint lengths[3] = {vShaderLength, fShaderLength, (GLint)gShaderFile.size()};
+        uint64_t cacheKey = programCache().key(sources, lengths, geometryPath != nullptr ? 3 : 2);
+        unsigned int program = glCreateProgram();
+        linked = programCache().load(program, cacheKey);
+        if (linked)
+            return program;
+        // a miss, or a binary the driver rejected: compile into a fresh program
+        glDeleteProgram(program);
+        // 3. compile shaders
+        unsigned int vertex, fragment;
+        // vertex shader
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, &vShaderLength);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, "VERTEX");
+        // fragment Shader
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, &fShaderLength);
+        glCompileShader(fragment);
+        checkCompileErrors(fragment, "FRAGMENT");
+        // if geometry shader is given, compile geometry shader
+        unsigned int geometry;
+        if(geometryPath != nullptr)
+        {
+            const char * gShaderCode = sourceOf(gShaderFile);
+            GLint gShaderLength = gShaderFile.size();
+            geometry = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(geometry, 1, &gShaderCode, &gShaderLength);
+            glCompileShader(geometry);
+            checkCompileErrors(geometry, "GEOMETRY");
+        }
+        // shader Program
+        program = glCreateProgram();
+        programCache().prepare(program);
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        if(geometryPath != nullptr)
+            glAttachShader(program, geometry);
+        glLinkProgram(program);
+        linked = checkCompileErrors(program, "PROGRAM");
+        if (linked)
+            programCache().store(program, cacheKey);
+        // delete the shaders as they're linked into our program now and no longer necessery
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        if(geometryPath != nullptr)
+            glDeleteShader(geometry);
+        return program;
+    }
+    // source text of a shader file, an empty string if it couldn't be read
+    // ------------------------------------------------------------------------
+    static const char *sourceOf(const AssetFile &file)
+    {
+        return file.isOpen() ? reinterpret_cast<const char *>(file.data()) : "";
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    // returns true if it compiled/linked fine
+    bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -193,6 +220,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success;
     }
 };
 #endif
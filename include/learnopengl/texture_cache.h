@@ -0,0 +1,239 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <learnopengl/asset_pack.h>
+#include <learnopengl/file_watcher.h>
+#include <learnopengl/hash.h>
+#include <learnopengl/texture_loader.h>
+
+#include <sys/stat.h>
+
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// a GL texture owned by the cache, alive for as long as a TextureHandle points at it
+struct CachedTexture {
+    unsigned int id;
+    GLenum target;
+    mutable uint64_t fileKey;   // re-keyed by reload(), guarded by the cache's mutex
+    bool srgb;
+    vector<string> paths;       // as loaded, one per face
+    vector<string> resolved;    // the same, resolved for matching changed files
+};
+
+typedef shared_ptr<const CachedTexture> TextureHandle;
+
+// Process-wide texture cache in front of the TextureLoader, shared by every Model and by main().
+// Lookups go through two hash maps: the resolved path(s) first, then the identity of the files (see
+// fileIdentity), so the same image reached through a different path or a hard link still ends up as one GL
+// texture. Neither reads the image, that's left to the loader's decode workers.
+// Both keys include how the image is loaded (2D or cubemap, sRGB or data), since those produce different textures.
+// Handles are refcounted; once the last one is gone the texture name is queued and deleted by collect() on the
+// GL thread, so handles may be dropped anywhere (even after the context is gone, at exit).
+// With the fileWatcher() running, a texture whose image (or baked .ktx2) changes on disk is reloaded in place.
+class TextureCache
+{
+public:
+    TextureHandle load2D(const string &path, bool srgb = true)
+    {
+        return acquire(GL_TEXTURE_2D, vector<string>(1, path), srgb);
+    }
+
+    // faces in the usual +X, -X, +Y, -Y, +Z, -Z order
+    TextureHandle loadCubemap(const vector<string> &faces)
+    {
+        return acquire(GL_TEXTURE_CUBE_MAP, faces, true);
+    }
+
+    // one image per layer of a GL_TEXTURE_2D_ARRAY, see TextureLoader::loadArray
+    TextureHandle loadArray(const vector<string> &layers, bool srgb = true)
+    {
+        return acquire(GL_TEXTURE_2D_ARRAY, layers, srgb);
+    }
+
+    // GL thread: deletes the textures nobody holds a handle to anymore. Waits while the loader still has
+    // uploads queued, a texture name must not be recycled under an upload that's in flight.
+    void collect()
+    {
+        vector<unsigned int> names;
+        {
+            lock_guard<mutex> lock(cacheMutex);
+            if (released.empty() || textureLoader().busy())
+                return;
+            names.swap(released);
+        }
+        glDeleteTextures(names.size(), names.data());
+    }
+
+    // GL thread: reloads every live texture made from the file at path (an image or its baked .ktx2)
+    void reload(const string &path)
+    {
+        string changed = resolvePath(path);
+        const string baked = ".ktx2";
+        if (changed.size() > baked.size() && changed.compare(changed.size() - baked.size(), baked.size(), baked) == 0)
+            changed.erase(changed.size() - baked.size());
+
+        vector<TextureHandle> affected;
+        {
+            lock_guard<mutex> lock(cacheMutex);
+            for (auto &entry : byFile)
+            {
+                TextureHandle handle = entry.second.lock();
+                if (handle && find(handle->resolved.begin(), handle->resolved.end(), changed) != handle->resolved.end())
+                    affected.push_back(handle);
+            }
+            // the files aren't what they were keyed as anymore, another path to the old ones mustn't get these
+            for (const TextureHandle &texture : affected)
+            {
+                byFile.erase(texture->fileKey);
+                texture->fileKey = fileKeyOf(texture->target, texture->srgb, texture->resolved);
+                byFile[texture->fileKey] = texture;
+            }
+        }
+        for (const TextureHandle &texture : affected)
+            textureLoader().reload(texture->id, texture->target, texture->paths, texture->srgb);
+    }
+
+private:
+    mutex cacheMutex;
+    unordered_map<string, weak_ptr<const CachedTexture>> byPath;
+    unordered_map<uint64_t, weak_ptr<const CachedTexture>> byFile;
+    vector<unsigned int> released;
+    set<string> watched;
+
+    // packed files are only known by their normalized path, loose ones are resolved through symlinks too
+    static string resolvePath(const string &path)
+    {
+        if (assetPack().contains(path))
+            return normalizeAssetPath(path);
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved))
+            return string(resolved);
+        return path;
+    }
+
+    // which file this is, without reading it: its place in the asset pack, or the device, inode, size and
+    // modification time of a loose file. A missing file hashes its path so it can't collide with a real image.
+    static uint64_t fileIdentity(const string &resolvedPath, uint64_t seed)
+    {
+        const unsigned char *data;
+        size_t size;
+        if (assetPack().find(resolvedPath, data, size))
+        {
+            uint64_t fields[] = {(uint64_t)(uintptr_t)data, (uint64_t)size};
+            return fnv1a64(fields, sizeof(fields), seed);
+        }
+        struct stat info;
+        if (stat(resolvedPath.c_str(), &info) != 0)
+            return fnv1a64(resolvedPath, seed);
+        uint64_t fields[] = {(uint64_t)info.st_dev, (uint64_t)info.st_ino, (uint64_t)info.st_size, (uint64_t)info.st_mtime};
+        return fnv1a64(fields, sizeof(fields), seed);
+    }
+
+    // how the image is loaded, the start of both keys
+    static string loadKind(GLenum target, bool srgb)
+    {
+        string kind = target == GL_TEXTURE_2D ? "2D" : target == GL_TEXTURE_CUBE_MAP ? "CUBE" : "ARRAY";
+        return kind + (srgb ? " srgb" : " linear");
+    }
+
+    static uint64_t fileKeyOf(GLenum target, bool srgb, const vector<string> &resolved)
+    {
+        uint64_t key = fnv1a64(loadKind(target, srgb));
+        for (const string &path : resolved)
+            key = fileIdentity(path, key);
+        return key;
+    }
+
+    TextureHandle acquire(GLenum target, const vector<string> &paths, bool srgb)
+    {
+        string pathKey = loadKind(target, srgb);
+        vector<string> resolved;
+        for (const string &path : paths)
+        {
+            resolved.push_back(resolvePath(path));
+            pathKey += '\n' + resolved.back();
+        }
+
+        {
+            lock_guard<mutex> lock(cacheMutex);
+            auto it = byPath.find(pathKey);
+            if (it != byPath.end())
+            {
+                TextureHandle handle = it->second.lock();
+                if (handle)
+                    return handle;
+                byPath.erase(it);
+            }
+        }
+
+        // not seen under this path, maybe under another one
+        uint64_t fileKey = fileKeyOf(target, srgb, resolved);
+
+        lock_guard<mutex> lock(cacheMutex);
+        auto it = byFile.find(fileKey);
+        if (it != byFile.end())
+        {
+            TextureHandle handle = it->second.lock();
+            if (handle)
+            {
+                byPath[pathKey] = handle;
+                return handle;
+            }
+        }
+
+        CachedTexture *texture = new CachedTexture();
+        texture->target = target;
+        texture->fileKey = fileKey;
+        texture->srgb = srgb;
+        texture->paths = paths;
+        texture->resolved = resolved;
+        if (target == GL_TEXTURE_2D)
+            texture->id = textureLoader().load2D(paths[0], srgb);
+        else if (target == GL_TEXTURE_CUBE_MAP)
+            texture->id = textureLoader().loadCubemap(paths);
+        else
+            texture->id = textureLoader().loadArray(paths, srgb);
+        TextureHandle handle(texture, [this](const CachedTexture *texture) { release(texture); });
+        byPath[pathKey] = handle;
+        byFile[fileKey] = handle;
+        for (const string &path : resolved)
+        {
+            if (!watched.insert(path).second)
+                continue;
+            fileWatcher().watch(path, [this, path] { reload(path); });
+            fileWatcher().watch(path + ".ktx2", [this, path] { reload(path); });
+        }
+        return handle;
+    }
+
+    // runs when the last handle goes away, on whatever thread dropped it. Expired path entries are
+    // dropped lazily on their next lookup.
+    void release(const CachedTexture *texture)
+    {
+        {
+            lock_guard<mutex> lock(cacheMutex);
+            auto it = byFile.find(texture->fileKey);
+            if (it != byFile.end() && it->second.expired())
+                byFile.erase(it);
+            released.push_back(texture->id);
+        }
+        delete texture;
+    }
+};
+
+inline TextureCache &textureCache()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+#endif
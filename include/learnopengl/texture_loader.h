@@ -0,0 +1,760 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <learnopengl/asset_pack.h>
+#include <learnopengl/async_reader.h>
+#include <learnopengl/ktx2.h>
+#include <learnopengl/mipmap.h>
+#include <learnopengl/thread_pool.h>
+#include <learnopengl/trace.h>
+#include <learnopengl/upload_thread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+using namespace std;
+
+// compressed formats glad's 3.3 core profile doesn't know about
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#define GL_COMPRESSED_SRGB8_ETC2 0x9275
+#define GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 0x9276
+#define GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2 0x9277
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC 0x9279
+#endif
+
+// which block-compressed formats the context can sample, queried once on the GL thread
+struct CompressedFormats {
+    bool s3tc = false;
+    bool s3tcSrgb = false;
+    bool bptc = false;
+    bool etc2 = false;
+
+    // GL internal format for a KTX2 VkFormat, 0 if the context can't take it
+    GLenum glFormat(uint32_t vkFormat) const
+    {
+        switch (vkFormat)
+        {
+            case KTX2_FORMAT_BC1_RGB_UNORM: return s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+            case KTX2_FORMAT_BC1_RGBA_UNORM: return s3tc ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : 0;
+            case KTX2_FORMAT_BC3_UNORM: return s3tc ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+            case KTX2_FORMAT_BC1_RGB_SRGB: return s3tcSrgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : 0;
+            case KTX2_FORMAT_BC1_RGBA_SRGB: return s3tcSrgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT : 0;
+            case KTX2_FORMAT_BC3_SRGB: return s3tcSrgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : 0;
+            case KTX2_FORMAT_BC7_UNORM: return bptc ? GL_COMPRESSED_RGBA_BPTC_UNORM : 0;
+            case KTX2_FORMAT_BC7_SRGB: return bptc ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : 0;
+            case KTX2_FORMAT_ETC2_RGB8_UNORM: return etc2 ? GL_COMPRESSED_RGB8_ETC2 : 0;
+            case KTX2_FORMAT_ETC2_RGB8_SRGB: return etc2 ? GL_COMPRESSED_SRGB8_ETC2 : 0;
+            case KTX2_FORMAT_ETC2_RGB8A1_UNORM: return etc2 ? GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2 : 0;
+            case KTX2_FORMAT_ETC2_RGB8A1_SRGB: return etc2 ? GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2 : 0;
+            case KTX2_FORMAT_ETC2_RGBA8_UNORM: return etc2 ? GL_COMPRESSED_RGBA8_ETC2_EAC : 0;
+            case KTX2_FORMAT_ETC2_RGBA8_SRGB: return etc2 ? GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC : 0;
+        }
+        return 0;
+    }
+};
+
+inline CompressedFormats queryCompressedFormats()
+{
+    GLint major = 0, minor = 0, count = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    const int version = major * 10 + minor;
+
+    bool textureSrgb = false;
+    CompressedFormats formats;
+    for (GLint i = 0; i < count; i++)
+    {
+        const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (!name)
+            continue;
+        string extension(name);
+        if (extension == "GL_EXT_texture_compression_s3tc")
+            formats.s3tc = true;
+        else if (extension == "GL_EXT_texture_sRGB" || extension == "GL_EXT_texture_compression_s3tc_srgb")
+            textureSrgb = true;
+        else if (extension == "GL_ARB_texture_compression_bptc")
+            formats.bptc = true;
+        else if (extension == "GL_ARB_ES3_compatibility")
+            formats.etc2 = true;
+    }
+    formats.s3tcSrgb = formats.s3tc && textureSrgb;
+    formats.bptc = formats.bptc || version >= 42;
+    formats.etc2 = formats.etc2 || version >= 43;
+    return formats;
+}
+
+// a texture whose images have been decoded (and mipmapped) on a worker thread, waiting to be
+// uploaded on the GL thread. Holds the upload cursor so the upload can be spread over several frames.
+struct StreamingTexture {
+    unsigned int textureID;
+    GLenum target;                  // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP or GL_TEXTURE_2D_ARRAY
+    bool srgb;                      // color image, mipmapped in linear light
+    GLenum format;
+    bool compressed = false;        // faces hold block-compressed levels read from baked KTX2 files
+    vector<string> paths;           // one per face (array layer)
+    vector<vector<MipLevel>> faces; // [face][level], level 0 is full resolution
+    vector<GLenum> faceFormats;     // per face, settled into format once every face is decoded
+    vector<char> failed;            // per face, set when the decode failed (not vector<bool>, faces are decoded concurrently)
+    atomic<int> facesRemaining;
+
+    // upload cursor, only touched on the GL thread
+    bool allocated = false;
+    int level = 0;
+    unsigned int face = 0;
+    int row = 0;
+};
+
+// layers of a texture array all get the same size, the largest one's but no more than this a side. A layer
+// is usually drawn on a fixed size quad (the flags), more than this is memory nobody sees.
+const int TEXTURE_ARRAY_MAX_SIZE = 1024;
+
+// Reads image files through the AsyncReader, decodes them on a worker pool and uploads them on the GL thread, or on the upload thread when it runs.
+// load2D/loadCubemap return a usable texture name right away: it starts out as a 1x1 placeholder and
+// the decode (plus the CPU mip chain) runs in the background. The placeholder sits at the highest mip level
+// GL allows, with GL_TEXTURE_BASE_LEVEL/GL_TEXTURE_MAX_LEVEL pointing at it, so the real levels can be
+// written while the texture is being sampled.
+// Without the upload thread the GL thread either streams the data in with pump(), a bounded number of bytes
+// per frame, or blocks on finish(). Streaming goes from the smallest mip level up and moves
+// GL_TEXTURE_BASE_LEVEL down as each level completes, so a texture is never sampled half uploaded; it just
+// gets sharper over a few frames. With the upload thread every texture is uploaded in one go over there
+// and switched over to its real levels once the upload's fence has been signaled.
+// An image with an up to date <image>.ktx2 next to it (see tools/texture_baker.cpp) is read from that instead,
+// as long as the context supports its format: no decode and no CPU mipmapping, just a copy of the blocks.
+class TextureLoader
+{
+public:
+    explicit TextureLoader(unsigned int threads = 0) : pool(threads), pending(0), decoding(0) {}
+
+    // srgb marks color images (as opposed to specular/normal data), it only changes how the mips are filtered
+    unsigned int load2D(const string &path, bool srgb = true)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        uploadPlaceholder(GL_TEXTURE_2D, GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        shareWithUploadThread();
+        queueDecode(textureID, GL_TEXTURE_2D, vector<string>(1, path), srgb);
+        return textureID;
+    }
+
+    // faces in the usual +X, -X, +Y, -Y, +Z, -Z order
+    unsigned int loadCubemap(const vector<string> &faces)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        for (unsigned int i = 0; i < faces.size(); i++)
+            uploadPlaceholder(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+        shareWithUploadThread();
+        queueDecode(textureID, GL_TEXTURE_CUBE_MAP, faces, true);
+        return textureID;
+    }
+
+    // one image per layer of a GL_TEXTURE_2D_ARRAY. Every layer goes up as RGBA, resampled to a common size
+    // when they differ (see TEXTURE_ARRAY_MAX_SIZE).
+    unsigned int loadArray(const vector<string> &layers, bool srgb = true)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+        uploadPlaceholder(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_2D_ARRAY, layers.size());
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        shareWithUploadThread();
+        queueDecode(textureID, GL_TEXTURE_2D_ARRAY, layers, srgb);
+        return textureID;
+    }
+
+    // decodes the images of an already loaded texture again (they changed on disk) and uploads them over
+    // its levels, the texture name stays the same. It goes back to the placeholder first, so the levels are
+    // never sampled while they're being respecified (possibly at another size, on the upload thread's
+    // context); the new ones show up like a first load. If the decode fails the placeholder stays.
+    void reload(unsigned int textureID, GLenum target, const vector<string> &paths, bool srgb)
+    {
+        glBindTexture(target, textureID);
+        if (target == GL_TEXTURE_CUBE_MAP)
+            for (unsigned int i = 0; i < paths.size(); i++)
+                uploadPlaceholder(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i);
+        else
+            uploadPlaceholder(target, target, paths.size());
+        glBindTexture(target, 0);
+
+        shareWithUploadThread();
+        queueDecode(textureID, target, paths, srgb);
+    }
+
+    // uploads at most about byteBudget bytes of decoded image data (always at least one row, so it
+    // keeps making progress). Returns true while there is still work queued.
+    // must be called on the thread that owns the GL context.
+    bool pump(size_t byteBudget)
+    {
+        if (uploadThread().running())
+        {
+            // the uploads happen over there, just publish whatever is done
+            uploadThread().poll();
+            lock_guard<mutex> lock(readyMutex);
+            return pending > 0;
+        }
+
+        size_t uploaded = 0;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        while (uploaded < byteBudget)
+        {
+            if (!current)
+            {
+                lock_guard<mutex> lock(readyMutex);
+                if (ready.empty())
+                    break;
+                current = ready.front();
+                ready.pop_front();
+            }
+            uploaded += uploadSome(*current, byteBudget - uploaded);
+            if (current->level < 0)
+            {
+                current.reset();
+                lock_guard<mutex> lock(readyMutex);
+                pending--;
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        lock_guard<mutex> lock(readyMutex);
+        return pending > 0;
+    }
+
+    // true while some queued texture hasn't been fully uploaded yet
+    bool busy()
+    {
+        lock_guard<mutex> lock(readyMutex);
+        return pending > 0;
+    }
+
+    // uploads everything that's queued, blocking until the last decode has finished
+    void finish()
+    {
+        if (uploadThread().running())
+        {
+            {
+                unique_lock<mutex> lock(readyMutex);
+                readyCondition.wait(lock, [this] { return decoding == 0; });
+            }
+            uploadThread().finish();
+            return;
+        }
+
+        for (;;)
+        {
+            if (!current)
+            {
+                unique_lock<mutex> lock(readyMutex);
+                readyCondition.wait(lock, [this] { return !ready.empty() || pending == 0; });
+                if (ready.empty())
+                    return;
+            }
+            pump(SIZE_MAX);
+        }
+    }
+
+private:
+    ThreadPool pool;
+    mutex readyMutex;
+    condition_variable readyCondition;
+    deque<shared_ptr<StreamingTexture>> ready;
+    shared_ptr<StreamingTexture> current;
+    size_t pending;     // queued textures that haven't been fully uploaded yet
+    size_t decoding;    // queued textures that are still being decoded
+
+    static const CompressedFormats &compressedFormats()
+    {
+        static const CompressedFormats formats = queryCompressedFormats();
+        return formats;
+    }
+
+    // the highest mip level GL accepts, no real image ever needs it (except a 1x1 level of the largest size)
+    static int placeholderLevel()
+    {
+        static int level = -1;
+        if (level < 0)
+        {
+            GLint maxSize = 1;
+            glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+            level = 0;
+            while ((maxSize >>= 1) > 0)
+                level++;
+        }
+        return level;
+    }
+
+    static void uploadPlaceholder(GLenum target, GLenum imageTarget, unsigned int layers = 1)
+    {
+        static const unsigned char grey[4] = {128, 128, 128, 255};
+        if (target == GL_TEXTURE_2D_ARRAY)
+        {
+            vector<unsigned char> greyLayers;
+            for (unsigned int i = 0; i < layers; i++)
+                greyLayers.insert(greyLayers.end(), grey, grey + 4);
+            glTexImage3D(imageTarget, placeholderLevel(), GL_RGBA, 1, 1, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, greyLayers.data());
+        }
+        else
+            glTexImage2D(imageTarget, placeholderLevel(), GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, placeholderLevel());
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, placeholderLevel());
+    }
+
+    // the upload thread may write into a texture created here as soon as its decode is done, it has to exist
+    // over there first (see GeometryArena::addBlock)
+    static void shareWithUploadThread()
+    {
+        if (uploadThread().running())
+            glFlush();
+    }
+
+    void queueDecode(unsigned int textureID, GLenum target, const vector<string> &paths, bool srgb)
+    {
+        shared_ptr<StreamingTexture> texture = make_shared<StreamingTexture>();
+        texture->textureID = textureID;
+        texture->target = target;
+        texture->srgb = srgb;
+        texture->format = GL_RGB;
+        texture->paths = paths;
+        texture->faces.resize(paths.size());
+        texture->faceFormats.assign(paths.size(), GL_RGB);
+        texture->failed.assign(paths.size(), false);
+        texture->facesRemaining = paths.size();
+        // queried here, on the GL thread, before any worker needs it
+        const CompressedFormats formats = compressedFormats();
+        {
+            lock_guard<mutex> lock(readyMutex);
+            pending++;
+            decoding++;
+        }
+        // every face is read asynchronously (all of them in flight at once) and decoded as its own job as soon
+        // as its file arrives, the last one to finish hands the texture on for uploading
+        for (unsigned int i = 0; i < paths.size(); i++)
+        {
+            string baked = bakedPath(paths[i]);
+            bool isBaked = !baked.empty();
+            asyncReader().read(isBaked ? baked : paths[i], [this, texture, i, formats, isBaked](shared_ptr<FileContents> contents) {
+                pool.enqueue([this, texture, i, formats, isBaked, contents] {
+                    decodeFace(*texture, i, formats, isBaked, *contents);
+                    faceDecoded(texture);
+                });
+            });
+        }
+    }
+
+    // worker thread, after each face. The last face of a texture settles its format and queues the upload.
+    void faceDecoded(const shared_ptr<StreamingTexture> &texture)
+    {
+        if (--texture->facesRemaining != 0)
+            return;
+        settleFormat(*texture);
+        bool uploadThreadRunning = uploadThread().running();
+        if (uploadThreadRunning)
+            uploadThread().submit([texture] { uploadAll(*texture); },
+                                  [this, texture] { publish(*texture); });
+        {
+            lock_guard<mutex> lock(readyMutex);
+            if (!uploadThreadRunning)
+                ready.push_back(texture);
+            decoding--;
+        }
+        readyCondition.notify_all();
+    }
+
+    // prints the failed faces, returns false if there's nothing to upload
+    static bool reportFailures(const StreamingTexture &texture)
+    {
+        bool ok = true;
+        for (unsigned int f = 0; f < texture.faces.size(); f++)
+        {
+            if (texture.failed[f])
+            {
+                if (texture.target == GL_TEXTURE_CUBE_MAP)
+                    std::cout << "Cubemap texture failed to load at path: " << texture.paths[f] << std::endl;
+                else
+                    std::cout << "Texture failed to load at path: " << texture.paths[f] << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    static bool anyFailed(const StreamingTexture &texture)
+    {
+        for (char failed : texture.failed)
+            if (failed)
+                return true;
+        return false;
+    }
+
+    // upload thread: writes every level of every face. Only the image data is touched, the sampler keeps
+    // using the placeholder level until publish() on the render thread switches it over.
+    static void uploadAll(StreamingTexture &texture)
+    {
+        if (anyFailed(texture))
+            return;
+        glBindTexture(texture.target, texture.textureID);
+        for (unsigned int l = 0; l < texture.faces[0].size(); l++)
+        {
+            defineLevel(texture, l, true);
+            // GL has its own copy now
+            for (vector<MipLevel> &face : texture.faces)
+                vector<unsigned char>().swap(face[l].pixels);
+        }
+        glBindTexture(texture.target, 0);
+    }
+
+    // render thread, once the upload thread's fence has been signaled
+    void publish(StreamingTexture &texture)
+    {
+        if (reportFailures(texture))
+        {
+            glBindTexture(texture.target, texture.textureID);
+            glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, texture.faces[0].size() - 1);
+        }
+        texture.faces.clear();
+        lock_guard<mutex> lock(readyMutex);
+        pending--;
+    }
+
+    // contents is the baked KTX2 file when isBaked is set, the image otherwise. A baked file that turns out
+    // to be unusable falls back to reading and decoding the image after all.
+    static void decodeFace(StreamingTexture &texture, unsigned int face, const CompressedFormats &formats, bool isBaked,
+                           const FileContents &contents)
+    {
+        TRACE_SCOPE_DETAIL("decode texture", texture.paths[face].c_str());
+        if (!isBaked)
+            decodeImage(texture, face, contents.data, contents.size);
+        else if (!loadBaked(texture, face, formats, contents))
+            decodeImage(texture, face);
+    }
+
+    // <path>.ktx2, if it's there and at least as new as the image it was baked from. A packed one is
+    // current as long as the image is packed too, the asset pack is built from both at once.
+    static string bakedPath(const string &path)
+    {
+        string baked = path + ".ktx2";
+        if (assetPack().contains(baked) && assetPack().contains(path))
+            return baked;
+        struct stat bakedInfo, sourceInfo;
+        if (stat(baked.c_str(), &bakedInfo) != 0)
+            return string();
+        if (stat(path.c_str(), &sourceInfo) == 0 && sourceInfo.st_mtime > bakedInfo.st_mtime)
+            return string();
+        return baked;
+    }
+
+    static bool loadBaked(StreamingTexture &texture, unsigned int face, const CompressedFormats &formats, const FileContents &file)
+    {
+        uint32_t vkFormat;
+        vector<Ktx2Level> levels;
+        if (!file.data || !parseKtx2(file.data, file.size, vkFormat, levels))
+        {
+            std::cout << "WARNING::TEXTURE_LOADER: ignoring invalid KTX2 file " << texture.paths[face] << ".ktx2" << std::endl;
+            return false;
+        }
+        GLenum format = formats.glFormat(vkFormat);
+        if (format == 0)
+            return false;
+
+        vector<MipLevel> &faceLevels = texture.faces[face];
+        faceLevels.resize(levels.size());
+        for (unsigned int l = 0; l < levels.size(); l++)
+        {
+            faceLevels[l].width = levels[l].width;
+            faceLevels[l].height = levels[l].height;
+            faceLevels[l].pixels.assign(levels[l].data, levels[l].data + levels[l].size);
+        }
+        texture.faceFormats[face] = format;
+        return true;
+    }
+
+    static bool isCompressedFormat(GLenum format)
+    {
+        return format != GL_RED && format != GL_RGB && format != GL_RGBA;
+    }
+
+    // every face of a cubemap (layer of an array) has to end up with the same format, size and level count.
+    // When only some faces were baked (or they were baked differently) the baked ones are decoded from their
+    // images after all.
+    static void settleFormat(StreamingTexture &texture)
+    {
+        if (anyFailed(texture))
+            return;
+        bool mixed = false;
+        for (unsigned int f = 1; f < texture.faces.size(); f++)
+            if (texture.faceFormats[f] != texture.faceFormats[0] || texture.faces[f].size() != texture.faces[0].size()
+                || texture.faces[f][0].width != texture.faces[0][0].width || texture.faces[f][0].height != texture.faces[0][0].height)
+                mixed = true;
+        if (mixed)
+        {
+            for (unsigned int f = 0; f < texture.faces.size(); f++)
+                if (isCompressedFormat(texture.faceFormats[f]))
+                    decodeImage(texture, f);
+        }
+        texture.format = texture.faceFormats[0];
+        texture.compressed = isCompressedFormat(texture.format);
+        if (texture.target == GL_TEXTURE_2D_ARRAY && !texture.compressed)
+            matchLayerSizes(texture);
+    }
+
+    // resamples the layers of an array to the size of the largest one (at most TEXTURE_ARRAY_MAX_SIZE a side)
+    // and builds their mips again
+    static void matchLayerSizes(StreamingTexture &texture)
+    {
+        int width = 0, height = 0;
+        for (const vector<MipLevel> &layer : texture.faces)
+        {
+            width = min(max(width, layer[0].width), TEXTURE_ARRAY_MAX_SIZE);
+            height = min(max(height, layer[0].height), TEXTURE_ARRAY_MAX_SIZE);
+        }
+        for (vector<MipLevel> &layer : texture.faces)
+        {
+            if (layer[0].width == width && layer[0].height == height)
+                continue;
+            LinearLevel linear = toLinear(layer[0], 4, texture.srgb);
+            // box filter most of the way down, bilinear alone would skip texels
+            while (linear.width >= 2 * width && linear.height >= 2 * height)
+                linear = downsample(linear);
+            linear = resample(linear, width, height);
+            layer.assign(1, fromLinear(linear, 4, texture.srgb));
+            buildMipChain(layer, 4, texture.srgb);
+        }
+    }
+
+    // reads the image right here, for the rare faces that have to be decoded again
+    static void decodeImage(StreamingTexture &texture, unsigned int face)
+    {
+        AssetFile file(texture.paths[face]);
+        decodeImage(texture, face, file.data(), file.size());
+    }
+
+    static void decodeImage(StreamingTexture &texture, unsigned int face, const unsigned char *fileData, size_t fileSize)
+    {
+        int width, height, nrComponents;
+        unsigned char *data = nullptr;
+        if (fileData)
+            data = stbi_load_from_memory(fileData, (int)fileSize, &width, &height, &nrComponents, 0);
+        if (!data)
+        {
+            texture.failed[face] = true;
+            return;
+        }
+
+        // cubemap faces always go up as RGB, like they always have, and array layers as RGBA so they share a format
+        int required = texture.target == GL_TEXTURE_CUBE_MAP ? 3 : texture.target == GL_TEXTURE_2D_ARRAY ? 4 : 0;
+        if (required != 0)
+        {
+            texture.faceFormats[face] = required == 3 ? GL_RGB : GL_RGBA;
+            if (nrComponents != required)
+            {
+                stbi_image_free(data);
+                data = stbi_load_from_memory(fileData, (int)fileSize, &width, &height, &nrComponents, required);
+                nrComponents = required;
+            }
+        }
+        else if (nrComponents == 1)
+            texture.faceFormats[face] = GL_RED;
+        else if (nrComponents == 4)
+            texture.faceFormats[face] = GL_RGBA;
+        else if (nrComponents == 2)
+        {
+            // no matching format for grey + alpha, expand it to RGBA
+            stbi_image_free(data);
+            data = stbi_load_from_memory(fileData, (int)fileSize, &width, &height, &nrComponents, 4);
+            nrComponents = 4;
+            texture.faceFormats[face] = GL_RGBA;
+        }
+
+        vector<MipLevel> &levels = texture.faces[face];
+        levels.resize(1);
+        levels[0].width = width;
+        levels[0].height = height;
+        levels[0].pixels.assign(data, data + (size_t)width * height * nrComponents);
+        stbi_image_free(data);
+        buildMipChain(levels, nrComponents, texture.srgb);
+    }
+
+    static GLenum faceTarget(const StreamingTexture &texture, unsigned int face)
+    {
+        return texture.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : texture.target;
+    }
+
+    // compressed levels go up in rows of 4x4 blocks
+    static int levelRows(const StreamingTexture &texture, const MipLevel &level)
+    {
+        return texture.compressed ? (level.height + 3) / 4 : level.height;
+    }
+
+    // defines level l of every face, with their pixels when withData is set and just the storage otherwise.
+    // Returns the number of bytes uploaded.
+    static size_t defineLevel(const StreamingTexture &texture, int l, bool withData)
+    {
+        const GLenum format = texture.format;
+        size_t uploaded = 0;
+        if (texture.target == GL_TEXTURE_2D_ARRAY)
+        {
+            // one image holds every layer, the layers are filled in one by one
+            const MipLevel &level = texture.faces[0][l];
+            GLsizei layers = texture.faces.size();
+            if (texture.compressed)
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, format, level.width, level.height, layers, 0,
+                                       level.pixels.size() * layers, nullptr);
+            else
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, l, format, level.width, level.height, layers, 0, format,
+                             GL_UNSIGNED_BYTE, nullptr);
+            if (withData)
+                for (unsigned int f = 0; f < texture.faces.size(); f++)
+                    uploaded += uploadRows(texture, f, l, 0, levelRows(texture, texture.faces[f][l]));
+            return uploaded;
+        }
+        for (unsigned int f = 0; f < texture.faces.size(); f++)
+        {
+            const MipLevel &level = texture.faces[f][l];
+            const unsigned char *pixels = withData ? level.pixels.data() : nullptr;
+            if (texture.compressed)
+                glCompressedTexImage2D(faceTarget(texture, f), l, format, level.width, level.height, 0,
+                                       level.pixels.size(), pixels);
+            else
+                glTexImage2D(faceTarget(texture, f), l, format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE,
+                             pixels);
+            if (withData)
+                uploaded += level.pixels.size();
+        }
+        return uploaded;
+    }
+
+    // uploads rows firstRow..firstRow + rows - 1 of one face's level, returns the number of bytes
+    static size_t uploadRows(const StreamingTexture &texture, unsigned int face, int l, int firstRow, int rows)
+    {
+        const MipLevel &level = texture.faces[face][l];
+        const GLenum format = texture.format;
+        size_t rowBytes = level.pixels.size() / levelRows(texture, level);
+        const unsigned char *pixels = level.pixels.data() + firstRow * rowBytes;
+        bool layered = texture.target == GL_TEXTURE_2D_ARRAY;
+        if (texture.compressed)
+        {
+            int y = firstRow * 4;
+            int height = min(rows * 4, level.height - y);
+            if (layered)
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, y, face, level.width, height, 1, format,
+                                          rows * rowBytes, pixels);
+            else
+                glCompressedTexSubImage2D(faceTarget(texture, face), l, 0, y, level.width, height, format,
+                                          rows * rowBytes, pixels);
+        }
+        else if (layered)
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, firstRow, face, level.width, rows, 1, format, GL_UNSIGNED_BYTE, pixels);
+        else
+            glTexSubImage2D(faceTarget(texture, face), l, 0, firstRow, level.width, rows, format, GL_UNSIGNED_BYTE, pixels);
+        return rows * rowBytes;
+    }
+
+    // advances the upload cursor of one texture, returns the number of bytes uploaded
+    size_t uploadSome(StreamingTexture &texture, size_t byteBudget)
+    {
+        if (!texture.allocated && !reportFailures(texture))
+        {
+            // keep the placeholder
+            texture.level = -1;
+            return 0;
+        }
+
+        const int levelCount = texture.faces[0].size();
+        size_t uploaded = 0;
+        glBindTexture(texture.target, texture.textureID);
+
+        if (!texture.allocated)
+        {
+            // allocate the whole chain and fill in the 1x1 level right away, it replaces the placeholder
+            for (int l = 0; l < levelCount; l++)
+                uploaded += defineLevel(texture, l, l == levelCount - 1);
+            glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, levelCount - 1);
+            glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+            texture.allocated = true;
+            texture.level = levelCount - 2;
+            texture.face = 0;
+            texture.row = 0;
+        }
+
+        while (texture.level >= 0 && uploaded < byteBudget)
+        {
+            MipLevel &level = texture.faces[texture.face][texture.level];
+            int rowCount = levelRows(texture, level);
+            size_t rowBytes = level.pixels.size() / rowCount;
+            int rows = (int)min<size_t>(rowCount - texture.row, max<size_t>(1, (byteBudget - uploaded) / rowBytes));
+            uploaded += uploadRows(texture, texture.face, texture.level, texture.row, rows);
+            texture.row += rows;
+            if (texture.row < rowCount)
+                continue;
+
+            // this face of the level is done, drop its pixels and move on
+            vector<unsigned char>().swap(level.pixels);
+            texture.row = 0;
+            if (++texture.face < texture.faces.size())
+                continue;
+
+            // every face of the level is in, let the sampler see it
+            texture.face = 0;
+            glTexParameteri(texture.target, GL_TEXTURE_BASE_LEVEL, texture.level);
+            texture.level--;
+        }
+        if (texture.level < 0)
+            texture.faces.clear();
+        return uploaded;
+    }
+};
+
+// process-wide loader shared by main() and the model texture path
+inline TextureLoader &textureLoader()
+{
+    static TextureLoader loader;
+    return loader;
+}
+
+#endif
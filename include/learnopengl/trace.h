@@ -0,0 +1,244 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+using namespace std;
+
+// Scoped trace markers for startup and the frame, written out as Chrome trace-event JSON (chrome://tracing,
+// ui.perfetto.dev) when the program runs with --trace <file>.
+//
+//   TRACE_SCOPE("skybox");                     // from here to the end of the block
+//   TRACE_SCOPE_DETAIL("loadTexture", path);   // with a string shown in the event's args
+//
+// Every thread records into a buffer of its own, a list of fixed-size chunks with one writer, so recording
+// takes no lock: the writer fills a slot and publishes it by bumping the chunk's count. write() can run while
+// other threads are still recording, it sees every event published before it got to their chunk.
+// With tracing off a marker is a load of one flag.
+// The time to the first presented frame is reported either way, startup regressions show up without a trace.
+
+struct TraceEvent {
+    const char *name;       // a string literal, only the pointer is kept
+    uint64_t start;         // ns since the trace epoch
+    uint64_t duration;
+    char detail[48];        // tail of the detail string, zero terminated
+};
+
+const size_t TRACE_CHUNK_EVENTS = 1024;
+
+struct TraceChunk {
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+    atomic<size_t> count{0};
+    atomic<TraceChunk *> next{nullptr};
+};
+
+struct ThreadTrace {
+    uint32_t tid;
+    char name[32] = {};
+    TraceChunk *head;
+    TraceChunk *tail;
+    ThreadTrace *nextThread = nullptr;
+};
+
+class Tracer
+{
+public:
+    Tracer() : epoch(chrono::steady_clock::now()) {}
+
+    // turns recording on, the trace goes to path when write() is called
+    void start(const string &path)
+    {
+        outputPath = path;
+        enabled.store(true, memory_order_release);
+    }
+
+    bool recording() const { return enabled.load(memory_order_relaxed); }
+
+    uint64_t now() const
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+    }
+
+    // shown as the name of the calling thread's track
+    void setThreadName(const char *name)
+    {
+        ThreadTrace *thread = current();
+        strncpy(thread->name, name, sizeof(thread->name) - 1);
+    }
+
+    void record(const char *name, uint64_t start, uint64_t end, const char *detail = nullptr)
+    {
+        ThreadTrace *thread = current();
+        TraceChunk *chunk = thread->tail;
+        size_t index = chunk->count.load(memory_order_relaxed);
+        if (index == TRACE_CHUNK_EVENTS)
+        {
+            TraceChunk *fresh = new TraceChunk();
+            chunk->next.store(fresh, memory_order_release);
+            thread->tail = chunk = fresh;
+            index = 0;
+        }
+        TraceEvent &event = chunk->events[index];
+        event.name = name;
+        event.start = start;
+        event.duration = end - start;
+        event.detail[0] = '\0';
+        if (detail)
+        {
+            // the end of a path says more than its start
+            size_t length = strlen(detail);
+            const char *tail = detail + (length >= sizeof(event.detail) ? length - sizeof(event.detail) + 1 : 0);
+            strncpy(event.detail, tail, sizeof(event.detail) - 1);
+            event.detail[sizeof(event.detail) - 1] = '\0';
+        }
+        chunk->count.store(index + 1, memory_order_release);
+    }
+
+    // render thread, after every glfwSwapBuffers: the first call reports the time to first frame
+    void frameDone()
+    {
+        if (firstFrame != 0)
+            return;
+        firstFrame = now();
+        std::cout << "TRACE:: time to first frame: " << firstFrame / 1000000.0 << " ms" << std::endl;
+        if (recording())
+            record("first frame", 0, firstFrame);
+    }
+
+    // writes everything recorded so far, returns false if tracing is off or the file can't be written
+    bool write()
+    {
+        if (!recording())
+            return false;
+        ofstream out(outputPath, ios::trunc);
+        if (!out)
+        {
+            std::cout << "ERROR::TRACE:: can't write " << outputPath << std::endl;
+            return false;
+        }
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        size_t events = 0;
+        for (ThreadTrace *thread = threads.load(memory_order_acquire); thread; thread = thread->nextThread)
+        {
+            if (thread->name[0])
+            {
+                out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << thread->tid
+                    << ",\"args\":{\"name\":\"" << escape(thread->name) << "\"}}";
+                first = false;
+            }
+            for (TraceChunk *chunk = thread->head; chunk; chunk = chunk->next.load(memory_order_acquire))
+            {
+                size_t count = chunk->count.load(memory_order_acquire);
+                for (size_t i = 0; i < count; i++)
+                {
+                    const TraceEvent &event = chunk->events[i];
+                    char times[64];
+                    snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", event.start / 1000.0, event.duration / 1000.0);
+                    out << (first ? "" : ",\n") << "{\"ph\":\"X\",\"name\":\"" << escape(event.name) << "\",\"pid\":1,\"tid\":"
+                        << thread->tid << ',' << times;
+                    if (event.detail[0])
+                        out << ",\"args\":{\"detail\":\"" << escape(event.detail) << "\"}";
+                    out << '}';
+                    first = false;
+                    events++;
+                }
+            }
+        }
+        out << "\n]}\n";
+        if (!out)
+        {
+            std::cout << "ERROR::TRACE:: can't write " << outputPath << std::endl;
+            return false;
+        }
+        std::cout << "TRACE:: " << events << " events written to " << outputPath << std::endl;
+        return true;
+    }
+
+private:
+    const chrono::steady_clock::time_point epoch;
+    atomic<bool> enabled{false};
+    string outputPath;
+    uint64_t firstFrame = 0;
+    // every thread that ever recorded, newest first. Buffers live as long as the process, a worker
+    // may still be recording while the tracer is torn down at exit.
+    atomic<ThreadTrace *> threads{nullptr};
+    atomic<uint32_t> nextTid{1};
+
+    ThreadTrace *current()
+    {
+        static thread_local ThreadTrace *thread = nullptr;
+        if (!thread)
+        {
+            thread = new ThreadTrace();
+            thread->tid = nextTid.fetch_add(1);
+            thread->head = thread->tail = new TraceChunk();
+            ThreadTrace *head = threads.load(memory_order_relaxed);
+            do
+                thread->nextThread = head;
+            while (!threads.compare_exchange_weak(head, thread, memory_order_release, memory_order_relaxed));
+        }
+        return thread;
+    }
+
+    static string escape(const char *text)
+    {
+        string escaped;
+        for (const char *c = text; *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+                escaped += '\\';
+            if ((unsigned char)*c < 0x20)
+                escaped += ' ';
+            else
+                escaped += *c;
+        }
+        return escaped;
+    }
+};
+
+inline Tracer &tracer()
+{
+    static Tracer t;
+    return t;
+}
+
+// records the time from its construction to the end of the enclosing block
+class TraceScope
+{
+public:
+    // detail has to outlive the scope, it's only copied at the end
+    explicit TraceScope(const char *name, const char *detail = nullptr)
+        : name(name), detail(detail), active(tracer().recording())
+    {
+        start = active ? tracer().now() : 0;
+    }
+
+    ~TraceScope()
+    {
+        if (active)
+            tracer().record(name, start, tracer().now(), detail);
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    const char *detail;
+    bool active;
+    uint64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_DETAIL(name, detail) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, detail)
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef UPLOAD_THREAD_H
+#define UPLOAD_THREAD_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <learnopengl/trace.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+// Thread with its own GL context, shared with the main window, that creates and fills buffers and textures
+// so big uploads never stall frame submission. Every job runs with the upload context current and is
+// followed by a glFenceSync; once the render thread sees the fence signaled in poll(), it runs the job's
+// publish callback, which is where the render thread may start using the objects (and build anything
+// that isn't shared between contexts, like VAOs).
+class UploadThread
+{
+public:
+    UploadThread() : window(nullptr), active(false), stopping(false), outstanding(0) {}
+
+    ~UploadThread()
+    {
+        stop();
+    }
+
+    // creates a hidden window sharing objects with the main one and starts the thread.
+    // GLFW wants windows created on the main thread, so this must be called from there.
+    bool start(GLFWwindow *sharedWith)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(1, 1, "upload", NULL, sharedWith);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create GL upload context, uploading on the render thread" << std::endl;
+            return false;
+        }
+        stopping = false;
+        worker = thread([this] { threadLoop(); });
+        active = true;
+        return true;
+    }
+
+    // must be called on the main thread before glfwTerminate
+    void stop()
+    {
+        if (!window)
+            return;
+        active = false;
+        {
+            lock_guard<mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobCondition.notify_one();
+        worker.join();
+        glfwDestroyWindow(window);
+        window = nullptr;
+
+        // nothing will signal the remaining fences anymore
+        for (Completion &completion : completed)
+            glDeleteSync(completion.fence);
+        completed.clear();
+    }
+
+    // safe to call from any thread
+    bool running() const { return active; }
+
+    // queues upload to run on the upload thread; publish runs later on the render thread, from poll()
+    void submit(function<void()> upload, function<void()> publish)
+    {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            jobs.push_back(Job{upload, publish});
+            outstanding++;
+        }
+        jobCondition.notify_one();
+    }
+
+    // render thread: publishes every job whose fence has been signaled. With wait set it blocks until
+    // at least one job has been published, unless nothing is outstanding.
+    void poll(bool wait = false)
+    {
+        for (;;)
+        {
+            Completion completion;
+            {
+                unique_lock<mutex> lock(jobMutex);
+                if (wait)
+                    completedCondition.wait(lock, [this] { return !completed.empty() || outstanding == 0; });
+                if (completed.empty())
+                    return;
+                completion = completed.front();
+            }
+
+            GLenum status = glClientWaitSync(completion.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+            {
+                if (wait)
+                    continue;
+                return;
+            }
+            glDeleteSync(completion.fence);
+            {
+                lock_guard<mutex> lock(jobMutex);
+                completed.pop_front();
+                outstanding--;
+            }
+            if (completion.publish)
+                completion.publish();
+            wait = false;
+        }
+    }
+
+    // render thread: blocks until every submitted job has been uploaded and published
+    void finish()
+    {
+        for (;;)
+        {
+            {
+                lock_guard<mutex> lock(jobMutex);
+                if (outstanding == 0)
+                    return;
+            }
+            poll(true);
+        }
+    }
+
+private:
+    struct Job {
+        function<void()> upload;
+        function<void()> publish;
+    };
+    struct Completion {
+        GLsync fence;
+        function<void()> publish;
+    };
+
+    GLFWwindow *window;
+    atomic<bool> active;
+    thread worker;
+    mutex jobMutex;
+    condition_variable jobCondition;
+    condition_variable completedCondition;
+    deque<Job> jobs;
+    deque<Completion> completed;
+    bool stopping;
+    size_t outstanding;
+
+    void threadLoop()
+    {
+        glfwMakeContextCurrent(window);
+        tracer().setThreadName("upload");
+        // rows of RGB images aren't 4-byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (;;)
+        {
+            Job job;
+            {
+                unique_lock<mutex> lock(jobMutex);
+                jobCondition.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    break;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            {
+                TRACE_SCOPE("upload");
+                job.upload();
+            }
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // make sure the fence (and the commands before it) actually reach the GPU
+            glFlush();
+            {
+                lock_guard<mutex> lock(jobMutex);
+                completed.push_back(Completion{fence, job.publish});
+            }
+            completedCondition.notify_all();
+        }
+        glfwMakeContextCurrent(NULL);
+    }
+};
+
+// process-wide upload thread, only used by the loaders once main() has started it
+inline UploadThread &uploadThread()
+{
+    static UploadThread thread;
+    return thread;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef VERTEX_PACKING_H
+#define VERTEX_PACKING_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Compact vertex layout, 20 bytes instead of the 56 of a full float Vertex. model_lighting.vs decodes it:
+//   position   3 x unorm16 relative to the mesh bounds (positionMin + value * positionExtent)
+//              the 4th unorm16 is the bitangent sign, 0 for -1 and 1 for +1
+//   normal     octahedral encoded, 2 x snorm16
+//   texcoords  2 x half float
+//   tangent    octahedral encoded, 2 x snorm16; bitangent = cross(normal, tangent) * sign
+struct PackedVertex {
+    uint16_t Position[4];
+    int16_t Normal[2];
+    uint16_t TexCoords[2];
+    int16_t Tangent[2];
+};
+
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex must stay tightly packed");
+
+inline int16_t packSnorm16(float value)
+{
+    return (int16_t)lroundf(std::max(-1.0f, std::min(1.0f, value)) * 32767.0f);
+}
+
+inline uint16_t packUnorm16(float value)
+{
+    return (uint16_t)lroundf(std::max(0.0f, std::min(1.0f, value)) * 65535.0f);
+}
+
+// maps a unit vector onto the octahedron and unfolds it into [-1, 1]^2, a zero vector comes out as +Z
+inline void octEncode(const glm::vec3 &n, int16_t out[2])
+{
+    float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (sum == 0.0f)
+    {
+        out[0] = out[1] = 0;
+        return;
+    }
+    float x = n.x / sum, y = n.y / sum;
+    if (n.z < 0.0f)
+    {
+        float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    out[0] = packSnorm16(x);
+    out[1] = packSnorm16(y);
+}
+
+// what the shader does, for checking the round trip on the CPU
+inline glm::vec3 octDecode(const int16_t in[2])
+{
+    glm::vec3 n(std::max(in[0] / 32767.0f, -1.0f), std::max(in[1] / 32767.0f, -1.0f), 0.0f);
+    n.z = 1.0f - std::fabs(n.x) - std::fabs(n.y);
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+inline PackedVertex packVertex(const glm::vec3 &position, const glm::vec3 &normal, const glm::vec2 &texCoords,
+                               const glm::vec3 &tangent, const glm::vec3 &bitangent,
+                               const glm::vec3 &boundsMin, const glm::vec3 &boundsExtent)
+{
+    PackedVertex packed;
+    for (int i = 0; i < 3; i++)
+        packed.Position[i] = boundsExtent[i] > 0.0f ? packUnorm16((position[i] - boundsMin[i]) / boundsExtent[i]) : 0;
+    packed.Position[3] = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? 0 : 65535;
+    octEncode(normal, packed.Normal);
+    packed.TexCoords[0] = glm::packHalf1x16(texCoords.x);
+    packed.TexCoords[1] = glm::packHalf1x16(texCoords.y);
+    octEncode(tangent, packed.Tangent);
+    return packed;
+}
+
+#endif
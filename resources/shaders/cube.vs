@@ -1,15 +1,16 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoords;
+// one per cube, drawn instanced (takes locations 2 to 5)
+layout (location = 2) in mat4 aInstanceModel;
 
 out vec2 TexCoords;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
     TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * aInstanceModel * vec4(aPos, 1.0);
 }
\ No newline at end of file
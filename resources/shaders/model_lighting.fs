@@ -40,6 +40,8 @@ struct SpotLight {
 struct Material {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
+    // layered materials (layered set) sample the layer given per instance out of this one instead
+    sampler2DArray texture_layers;
 
     float shininess;
 };
@@ -47,6 +49,7 @@ struct Material {
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
+flat in float Layer;
 
 uniform DirLight dirLight;
 
@@ -55,6 +58,7 @@ uniform PointLight pointLight2;
 uniform PointLight pointLight3;
 
 uniform Material material;
+uniform bool layered;
 
 uniform SpotLight spotLight;
 uniform bool spotLightOn;
@@ -62,6 +66,20 @@ uniform bool pointLightOn;
 
 uniform vec3 viewPosition;
 
+vec3 diffuseTexel()
+{
+    if (layered)
+        return vec3(texture(material.texture_layers, vec3(TexCoords, Layer)));
+    return vec3(texture(material.texture_diffuse1, TexCoords));
+}
+
+vec3 specularTexel()
+{
+    if (layered)
+        return texture(material.texture_layers, vec3(TexCoords, Layer)).xxx;
+    return texture(material.texture_specular1, TexCoords).xxx;
+}
+
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 {
     vec3 lightDir = normalize(-light.direction);
@@ -71,9 +89,9 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
+    vec3 ambient = light.ambient * diffuseTexel();
+    vec3 diffuse = light.diffuse * diff * diffuseTexel();
+    vec3 specular = light.specular * spec * specularTexel();
     return (ambient + diffuse + specular);
 }
 
@@ -90,9 +108,9 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
+    vec3 ambient = light.ambient * diffuseTexel();
+    vec3 diffuse = light.diffuse * diff * diffuseTexel();
+    vec3 specular = light.specular * spec * specularTexel();
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -115,9 +133,9 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
+    vec3 ambient = light.ambient * diffuseTexel();
+    vec3 diffuse = light.diffuse * diff * diffuseTexel();
+    vec3 specular = light.specular * spec * specularTexel();
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
@@ -1,20 +1,61 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+#extension GL_ARB_shader_draw_parameters : enable
+layout (location = 0) in vec4 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+// instanced draws (instanced set) take the model matrix per instance instead of the uniform (locations 5 to 8),
+// along with the texture array layer for layered materials
+layout (location = 5) in mat4 aInstanceModel;
+layout (location = 9) in float aLayer;
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
+flat out float Layer;
 
 uniform mat4 model;
+uniform bool instanced;
 uniform mat4 view;
 uniform mat4 projection;
 
+// which draw of a multi-draw this is (see multi_draw.h), per draw data is indexed with it. Without the
+// extension the draws go out one at a time and drawIDBase says which.
+uniform int drawIDBase;
+#ifdef GL_ARB_shader_draw_parameters
+#define DRAW_ID (drawIDBase + gl_DrawIDARB)
+#else
+#define DRAW_ID drawIDBase
+#endif
+// MULTI_DRAW_MAX in multi_draw.h
+#define MAX_DRAWS 64
+
+// set by Mesh::Draw (per draw, by Model::Draw) for meshes uploaded as PackedVertex: the position is normalized
+// to the mesh bounds and the normal is octahedral encoded in aNormal.xy
+uniform bool packedVertex;
+uniform vec3 positionMin[MAX_DRAWS];
+uniform vec3 positionExtent[MAX_DRAWS];
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal =  aNormal;
+    vec3 position = aPos.xyz;
+    vec3 normal = aNormal;
+    if (packedVertex)
+    {
+        position = positionMin[DRAW_ID] + aPos.xyz * positionExtent[DRAW_ID];
+        normal = octDecode(aNormal.xy);
+    }
+    FragPos = vec3((instanced ? aInstanceModel : model) * vec4(position, 1.0));
+    Normal =  normal;
     TexCoords = aTexCoords;
+    Layer = aLayer;
     gl_Position = projection * view * vec4(FragPos, 1.0);
-}
\ No newline at end of file
+}
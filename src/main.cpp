@@ -9,10 +9,21 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <learnopengl/asset_pack.h>
+#include <learnopengl/bvh.h>
+#include <learnopengl/file_watcher.h>
 #include <learnopengl/filesystem.h>
+#include <learnopengl/frustum.h>
+#include <learnopengl/instance_buffer.h>
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
+#include <learnopengl/occlusion.h>
+#include <learnopengl/render_queue.h>
+#include <learnopengl/texture_cache.h>
+#include <learnopengl/texture_loader.h>
+#include <learnopengl/trace.h>
+#include <learnopengl/upload_thread.h>
 
 #include <iostream>
 
@@ -28,9 +39,13 @@ void processInput(GLFWwindow *window);
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 
-unsigned int loadTexture(const char *path);
+TextureHandle loadTexture(const char *path);
 
-unsigned int loadCubemap(vector<std::string> faces);
+TextureHandle loadCubemap(vector<std::string> faces);
+
+TextureHandle loadTextureArray(vector<std::string> layers);
+
+int aimedRose();
 
 struct DirLight {
     glm::vec3 direction;
@@ -69,10 +84,38 @@ void setShader(Shader ourShader, DirLight dirLight, PointLight pointLight, SpotL
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+// the flag texture array is bound here, above the units model materials use
+const int FLAG_TEXTURE_UNIT = 8;
+
+// single-file asset pack, mapped at startup; loose files are used for anything it doesn't hold
+const char *const ASSET_PACK_PATH = "resources.pack";
+// textures start out as placeholders and stream in over the first frames instead of blocking startup
+const bool TEXTURE_STREAMING = true;
+const size_t TEXTURE_UPLOAD_BUDGET = 4 * 1024 * 1024; // bytes of texture data uploaded per frame while streaming
+// textures and model buffers are uploaded from a second, shared GL context on its own thread
+const bool GL_UPLOAD_THREAD = true;
+// model vertices go up as 20-byte PackedVertex instead of 56-byte float Vertex, decoded in model_lighting.vs
+const bool PACKED_VERTICES = true;
+// model meshes drop their CPU copy of the vertices and indices once uploaded, keeping only bounds and counts
+const bool RELEASE_MESH_GEOMETRY = true;
+// model LODs are picked so the simplification error stays under this many pixels on screen
+const float LOD_PIXEL_ERROR = 1.0f;
+// shaders and textures are reloaded when their files change on disk (inotify), edits show up without a restart
+const bool HOT_RELOAD = true;
+// roses can be picked this far (in world units) from their center, about the aim the game has always allowed
+const float ROSE_PICK_RADIUS = 1.5f;
+// the cubes are drawn into a small CPU depth buffer every frame and flags and roses hidden behind them are skipped
+const bool OCCLUSION_CULLING = true;
 
 bool spotLightOn = false;
 bool pointLightOn = true;
 
+// every object of the scene for culling and picking: the flags, then the cubes, then the roses
+Bvh sceneBvh;
+unsigned int firstRoseObject = 0;
+// a quarter of the window's resolution is plenty to tell what's behind a cube
+OcclusionBuffer occlusionBuffer(SCR_WIDTH / 4, SCR_HEIGHT / 4);
+
 // camera
 
 float lastX = SCR_WIDTH / 2.0f;
@@ -106,7 +149,7 @@ struct ProgramState {
 
     //Skybox
     vector<std::string> faces;
-    unsigned int cubemapTexture;
+    TextureHandle cubemapTexture;
 
     void SaveToFile(std::string filename);
 
@@ -147,10 +190,19 @@ ProgramState *programState;
 
 void DrawImGui(ProgramState *programState);
 
-int main() {
+int main(int argc, char **argv) {
+    // --trace <file> records startup and every frame, written as Chrome trace-event JSON on exit
+    tracer().setThreadName("render");
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--trace")
+            tracer().start(argv[i + 1]);
+
     // glfw: initialize and configure
     // ------------------------------
-    glfwInit();
+    {
+        TRACE_SCOPE("glfwInit");
+        glfwInit();
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -161,7 +213,11 @@ int main() {
 
     // glfw window creation
     // --------------------
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    GLFWwindow *window;
+    {
+        TRACE_SCOPE("glfwCreateWindow");
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    }
     if (window == NULL) {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -177,11 +233,26 @@ int main() {
 
     // glad: load all OpenGL function pointers
     // ---------------------------------------
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+    {
+        TRACE_SCOPE("gladLoadGLLoader");
+        if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
     }
 
+    // assets are read out of the pack when there is one (built with asset_packer), from loose files otherwise
+    if (assetPack().open(FileSystem::getPath(ASSET_PACK_PATH)))
+        std::cout << "ASSET_PACK:: using " << ASSET_PACK_PATH << std::endl;
+
+    // before anything is loaded, loaders register their files as they go
+    if (HOT_RELOAD)
+        fileWatcher().start();
+
+    // falls back to uploading on this thread if the shared context can't be created
+    if (GL_UPLOAD_THREAD)
+        uploadThread().start(window);
+
     programState = new ProgramState;
     programState->LoadFromFile("resources/program_state.txt");
     if (programState->ImGuiEnabled) {
@@ -234,9 +305,14 @@ int main() {
     Shader ourShader("resources/shaders/model_lighting.vs", "resources/shaders/model_lighting.fs");
     Shader skyboxShader("resources/shaders/skybox.vs", "resources/shaders/skybox.fs");
     Shader cubeShader("resources/shaders/cube.vs", "resources/shaders/cube.fs");
+    ourShader.WatchFiles();
+    skyboxShader.WatchFiles();
+    cubeShader.WatchFiles();
 
     // load models
     // -----------
+    meshVertexPacking() = PACKED_VERTICES;
+    meshGeometryRelease() = RELEASE_MESH_GEOMETRY;
 
     Model roseModel("resources/objects/rose/Models and Textures/rose.obj");
     roseModel.SetShaderTextureNamePrefix("material.");
@@ -392,27 +468,19 @@ int main() {
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 
 
-    // flags textures
-    unsigned int SRBflagTexture = loadTexture(FileSystem::getPath("resources/textures/flags/srb.png").c_str());
-    unsigned int RUSflagTexture = loadTexture(FileSystem::getPath("resources/textures/flags/rus.png").c_str());
-    unsigned int SPAflagTexture = loadTexture(FileSystem::getPath("resources/textures/flags/spa.png").c_str());
-    unsigned int SADflagTexture = loadTexture(FileSystem::getPath("resources/textures/flags/usa.png").c_str());
-    unsigned int BRAflagTexture = loadTexture(FileSystem::getPath("resources/textures/flags/bra.png").c_str());
-    unsigned int ARGflagTexture = loadTexture(FileSystem::getPath("resources/textures/flags/arg.png").c_str());
-    unsigned int CANflagTexture = loadTexture(FileSystem::getPath("resources/textures/flags/can.png").c_str());
-    unsigned int MEXflagTexture = loadTexture(FileSystem::getPath("resources/textures/flags/mex.png").c_str());
-
-    unsigned int textures[8];
-    textures[0] = SRBflagTexture;
-    textures[1] = RUSflagTexture;
-    textures[2] = SPAflagTexture;
-    textures[3] = SADflagTexture;
-    textures[4] = BRAflagTexture;
-    textures[5] = ARGflagTexture;
-    textures[6] = CANflagTexture;
-    textures[7] = MEXflagTexture;
-
-    unsigned int cubeTexture = loadTexture(FileSystem::getPath("resources/textures/box.png").c_str());
+    // flags textures, one layer of a texture array each (layer i goes on the flag at flagPos[i])
+    TextureHandle flagTextures = loadTextureArray({
+            FileSystem::getPath("resources/textures/flags/srb.png"),
+            FileSystem::getPath("resources/textures/flags/rus.png"),
+            FileSystem::getPath("resources/textures/flags/spa.png"),
+            FileSystem::getPath("resources/textures/flags/usa.png"),
+            FileSystem::getPath("resources/textures/flags/bra.png"),
+            FileSystem::getPath("resources/textures/flags/arg.png"),
+            FileSystem::getPath("resources/textures/flags/can.png"),
+            FileSystem::getPath("resources/textures/flags/mex.png"),
+    });
+
+    TextureHandle cubeTexture = loadTexture(FileSystem::getPath("resources/textures/box.png").c_str());
 
     // skybox textures
     programState->faces =
@@ -427,6 +495,13 @@ int main() {
 
     programState->cubemapTexture = loadCubemap(programState->faces);
 
+    // every image above (and the model materials) is decoding in parallel by now, upload them as they finish
+    if (!TEXTURE_STREAMING)
+    {
+        textureLoader().finish();
+        uploadThread().finish();
+    }
+
 
     cubeShader.use();
     cubeShader.setInt("texture1", 0);
@@ -456,6 +531,27 @@ int main() {
             glm::vec3(45.1f,-9.8f,-18.0f) // MEX
     };
 
+    // the flags don't move either: a matrix and a texture array layer per instance, all drawn in one call
+    vector<glm::mat4> flagModels;
+    vector<float> flagLayers;
+    for (unsigned int i = 0; i < flagPos.size(); i++) {
+        flagModels.push_back(glm::translate(glm::mat4(1.0f), flagPos[i]));
+        flagLayers.push_back(i);
+    }
+    InstanceBuffer flagInstances;
+    flagInstances.update(flagModels);
+    unsigned int flagLayerVBO;
+    glGenBuffers(1, &flagLayerVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, flagLayerVBO);
+    glBufferData(GL_ARRAY_BUFFER, flagLayers.size() * sizeof(float), flagLayers.data(), GL_STATIC_DRAW);
+    glBindVertexArray(VAO);
+    flagInstances.attach(5);
+    glBindBuffer(GL_ARRAY_BUFFER, flagLayerVBO);
+    glEnableVertexAttribArray(9);
+    glVertexAttribPointer(9, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+    glVertexAttribDivisor(9, 1);
+    glBindVertexArray(0);
+
 
     vector<glm::vec3> cubePos {
             glm::vec3(50.0f,0.0f,-10.0f), // ARG
@@ -468,15 +564,124 @@ int main() {
             glm::vec3(65.0f,0.0f,-15.0f) // SPA
     };
 
+    // the cubes don't move, their matrices go into the instance buffer once and every cube is drawn in one call
+    vector<glm::mat4> cubeModels;
+    for (const glm::vec3 &position : cubePos) {
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, position);
+        model = glm::scale(model, glm::vec3(3.0f));
+        cubeModels.push_back(model);
+    }
+    InstanceBuffer cubeInstances;
+    cubeInstances.update(cubeModels);
+    glBindVertexArray(cubeVAO);
+    cubeInstances.attach(2);
+    glBindVertexArray(0);
+
+    // the cubes are the occluders, their triangles in world space
+    vector<glm::vec3> occluderTriangles;
+    for (const glm::mat4 &model : cubeModels)
+        for (unsigned int i = 0; i < 36; i++)
+            occluderTriangles.push_back(glm::vec3(model * glm::vec4(cubeVertices[i * 5], cubeVertices[i * 5 + 1], cubeVertices[i * 5 + 2], 1.0f)));
+    occlusionBuffer.setOccluders(move(occluderTriangles));
+
     vector<glm::vec3> rosePos {
             glm::vec3(40.0f,-5.0f,-16.0f),
             glm::vec3(65.0f,-10.0f,-5.2f),
             glm::vec3(50.0f,0.0f,-10.0f)
     };
 
+    // world space bounds of everything in the scene, flags and cubes from the quad and cube vertices. Flags and
+    // cubes don't move, the roses are refit every frame. Their boxes are at least ROSE_PICK_RADIUS around the
+    // center so they can be aimed at from a distance, culling them a little late costs nothing.
+    glm::vec3 roseMin, roseMax;
+    roseModel.Bounds(roseMin, roseMax);
+    auto roseBounds = [&](const glm::mat4 &model) {
+        Aabb box = transformBounds(model, roseMin, roseMax);
+        glm::vec3 center(model[3]);
+        box.boundsMin = glm::min(box.boundsMin, center - glm::vec3(ROSE_PICK_RADIUS));
+        box.boundsMax = glm::max(box.boundsMax, center + glm::vec3(ROSE_PICK_RADIUS));
+        return box;
+    };
+    vector<Aabb> sceneBounds;
+    glm::vec3 boundsMin, boundsMax;
+    boundsOf(vertices, 4, 8, boundsMin, boundsMax);
+    for (const glm::mat4 &model : flagModels)
+        sceneBounds.push_back(transformBounds(model, boundsMin, boundsMax));
+    const unsigned int firstCubeObject = sceneBounds.size();
+    boundsOf(cubeVertices, 36, 5, boundsMin, boundsMax);
+    for (const glm::mat4 &model : cubeModels)
+        sceneBounds.push_back(transformBounds(model, boundsMin, boundsMax));
+    firstRoseObject = sceneBounds.size();
+    for (const glm::vec3 &position : rosePos)
+        sceneBounds.push_back(roseBounds(glm::translate(glm::mat4(1.0f), position)));
+    sceneBvh.build(sceneBounds);
+
+    // the instance buffers only hold what's on screen and are rewritten when that changes
+    vector<unsigned int> visibleObjects, visibleFlags, visibleCubes, drawnFlags, drawnCubes;
+    for (unsigned int i = 0; i < flagModels.size(); i++)
+        drawnFlags.push_back(i);
+    for (unsigned int i = 0; i < cubeModels.size(); i++)
+        drawnCubes.push_back(i);
+    vector<glm::mat4> visibleModels;
+    vector<float> visibleLayers;
+
+    // the frame's draws, set up once: each pass submits its command with a depth every frame and the render
+    // queue sorts them by state and depth before anything is drawn
+    glm::mat4 projection, view;
+    Frustum frustum;
+    // the roses on screen this frame
+    vector<glm::mat4> visibleRoses;
+    RenderQueue renderQueue(100.0f);
+    renderQueue.perFrame(ourShader, [&] {
+        setShader(ourShader, dirLight, pointLight, spotLight);
+        ourShader.setMat4("projection", projection);
+        ourShader.setMat4("view", view);
+    });
+    renderQueue.perFrame(cubeShader, [&] {
+        cubeShader.setMat4("view", view);
+        cubeShader.setMat4("projection", projection);
+    });
+    renderQueue.perFrame(skyboxShader, [&] {
+        skyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
+        skyboxShader.setMat4("projection", projection);
+    });
+
+    // render - FLAGS
+    RenderCommand flagsCommand{RENDER_PASS_OPAQUE, &ourShader, VAO, FLAG_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, flagTextures->id, [&] {
+        TRACE_SCOPE("flags");
+        ourShader.setBool("instanced", true);
+        ourShader.setBool("layered", true);
+        glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, flagInstances.count);
+        ourShader.setBool("instanced", false);
+        ourShader.setBool("layered", false);
+    }};
+
+    // render - CUBES
+    RenderCommand cubesCommand{RENDER_PASS_OPAQUE, &cubeShader, cubeVAO, 0, GL_TEXTURE_2D, cubeTexture->id, [&] {
+        TRACE_SCOPE("cubes");
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 36, cubeInstances.count);
+    }};
+
+    // render - ROSES, the model binds its own VAOs and materials
+    RenderCommand rosesCommand{RENDER_PASS_OPAQUE, &ourShader, 0, 0, GL_TEXTURE_2D, 0, [&] {
+        TRACE_SCOPE("roses");
+        // all the visible ones in one instanced draw per visible mesh
+        roseModel.Cull(frustum, visibleRoses.data(), visibleRoses.size());
+        roseModel.SelectLod(visibleRoses.data(), visibleRoses.size(), view, projection, SCR_HEIGHT, LOD_PIXEL_ERROR);
+        roseModel.DrawInstanced(ourShader, visibleRoses);
+    }};
+
+    // draw skybox
+    RenderCommand skyboxCommand{RENDER_PASS_SKY, &skyboxShader, skyboxVAO, 0, GL_TEXTURE_CUBE_MAP, programState->cubemapTexture->id, [&] {
+        TRACE_SCOPE("skybox");
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+    }};
+
     // render loop
     // -----------
     while (!glfwWindowShouldClose(window)) {
+        TRACE_SCOPE("frame");
         // per-frame time logic
         // --------------------
         float currentFrame = glfwGetTime();
@@ -487,59 +692,24 @@ int main() {
         // -----
         processInput(window);
 
+        {
+            TRACE_SCOPE("streaming");
+            // streamed textures and hot reloaded ones (with streaming off too) are uploaded from here
+            if (textureLoader().busy())
+                textureLoader().pump(TEXTURE_UPLOAD_BUDGET);
+            textureCache().collect();
+            fileWatcher().poll();
+        }
+
         // render
         // ------
         glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        setShader(ourShader, dirLight, pointLight, spotLight);
-
-        glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = programState->camera.GetViewMatrix();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
-
-        // render - FLAGS
-        glm::mat4 model = glm::mat4(1.0f);
-
-        for(int i=0; i<flagPos.size(); i++) {
-            glBindTexture(GL_TEXTURE_2D, textures[i]);
-
-            ourShader.use();
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, flagPos[i]);
-            model = glm::scale(model, glm::vec3(1.0f));
+        projection = glm::perspective(glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+        view = programState->camera.GetViewMatrix();
 
-            ourShader.setMat4("model", model);
-            ourShader.setMat4("view", view);
-            ourShader.setMat4("projection", projection);
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-        }
-
-
-        // render - CUBES
-        for(int i=0; i<cubePos.size(); i++) {
-            cubeShader.use();
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, cubePos[i]);
-            model = glm::scale(model, glm::vec3(3.0f));
-
-            cubeShader.setMat4("model", model);
-            cubeShader.setMat4("view", view);
-            cubeShader.setMat4("projection", projection);
-            //cubes
-            glBindVertexArray(cubeVAO);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, cubeTexture);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-            glBindVertexArray(0);
-        }
-
-
-        // render - ROSES
         // 1
-        ourShader.use();
         glm::mat4 modelRose1 = glm::mat4(1.0f);
         modelRose1 = glm::translate(modelRose1,rosePos[0]);
         if(programState->rose1Collected) {
@@ -549,8 +719,6 @@ int main() {
         else {
             modelRose1 = glm::scale(modelRose1, glm::vec3(0.015f));
         }
-        ourShader.setMat4("model", modelRose1);
-        roseModel.Draw(ourShader);
 
         // 2
         glm::mat4 modelRose2 = glm::mat4(1.0f);
@@ -562,8 +730,6 @@ int main() {
         else {
             modelRose2 = glm::scale(modelRose2, glm::vec3(0.015f));
         }
-        ourShader.setMat4("model", modelRose2);
-        roseModel.Draw(ourShader);
 
         // 3
         glm::mat4 modelRose3 = glm::mat4(1.0f);
@@ -575,60 +741,102 @@ int main() {
         else {
             modelRose3 = glm::scale(modelRose3, glm::vec3(0.015f));
         }
-        ourShader.setMat4("model", modelRose3);
-        roseModel.Draw(ourShader);
-
-        // draw skybox
-        glDepthMask(GL_FALSE);
-        glDepthFunc(GL_LEQUAL);
-        skyboxShader.use();
-        view = glm::mat4(glm::mat3(programState->camera.GetViewMatrix()));
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, programState->cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthMask(GL_TRUE);
-        glDepthFunc(GL_LESS);
+        glm::mat4 roseModels[] = {modelRose1, modelRose2, modelRose3};
 
+        // frustum and occlusion culling, only what's on screen and not behind a cube gets submitted
+        {
+            TRACE_SCOPE("culling");
+            frustum = Frustum(projection * view);
+            for (unsigned int i = 0; i < 3; i++)
+                sceneBvh.update(firstRoseObject + i, roseBounds(roseModels[i]));
+
+            // sorted, so an unchanged set compares equal
+            sceneBvh.queryFrustum(frustum, visibleObjects);
+            sort(visibleObjects.begin(), visibleObjects.end());
+            // then occlusion culling of the flags and roses against the cubes. Roses are tested with their own
+            // bounds, the picking ones are as big as the cube around them.
+            if (OCCLUSION_CULLING)
+                occlusionBuffer.render(projection * view);
+            visibleFlags.clear();
+            visibleCubes.clear();
+            visibleRoses.clear();
+            for (unsigned int object : visibleObjects) {
+                if (object < firstCubeObject) {
+                    if (!OCCLUSION_CULLING || occlusionBuffer.visible(sceneBvh.bounds(object)))
+                        visibleFlags.push_back(object);
+                }
+                else if (object < firstRoseObject)
+                    visibleCubes.push_back(object - firstCubeObject);
+                else {
+                    const glm::mat4 &model = roseModels[object - firstRoseObject];
+                    if (!OCCLUSION_CULLING || occlusionBuffer.visible(transformBounds(model, roseMin, roseMax)))
+                        visibleRoses.push_back(model);
+                }
+            }
 
-        double xpos = programState->camera.Front.x;
-        double ypos = programState->camera.Front.y;
-        double zpos = programState->camera.Front.z;
-        double zoom = programState->camera.Zoom;
+            if (visibleFlags != drawnFlags) {
+                drawnFlags = visibleFlags;
+                visibleModels.clear();
+                visibleLayers.clear();
+                for (unsigned int i : visibleFlags) {
+                    visibleModels.push_back(flagModels[i]);
+                    visibleLayers.push_back(flagLayers[i]);
+                }
+                flagInstances.update(visibleModels, GL_STREAM_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, flagLayerVBO);
+                glBufferData(GL_ARRAY_BUFFER, visibleLayers.size() * sizeof(float), visibleLayers.data(), GL_STREAM_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
 
-        if ((xpos + 0.128)*(xpos + 0.128) + (ypos + 0.064)*(ypos + 0.064) + (zpos + 0.989)*(zpos + 0.989) < 0.002
-            && zoom <= 7 && zoom >= 3 && programState->gameStart) {
-            spotLightOn = true;
-        }
-        else if ((xpos - 0.208)*(xpos - 0.208) + (ypos - 0.099)*(ypos - 0.099) + (zpos + 0.972)*(zpos + 0.972) < 0.002
-                 && zoom <= 8 && zoom >= 3 && programState->gameStart) {
-            spotLightOn = true;
-        }
-        else if ((xpos - 0.66)*(xpos - 0.66) + (ypos + 0.226)*(ypos + 0.226) + (zpos + 0.715)*(zpos + 0.715) < 0.002
-                 && zoom <= 7 && zoom >= 3 && programState->gameStart) {
-            spotLightOn = true;
-        }
-        else {
-            spotLightOn = false;
+            if (visibleCubes != drawnCubes) {
+                drawnCubes = visibleCubes;
+                visibleModels.clear();
+                for (unsigned int i : visibleCubes)
+                    visibleModels.push_back(cubeModels[i]);
+                cubeInstances.update(visibleModels, GL_STREAM_DRAW);
+            }
         }
 
+        // opaque draws front to back by their nearest copy, the skybox last
+        if (flagInstances.count > 0)
+            renderQueue.submit(flagsCommand, viewDepth(view, flagPos));
+        if (cubeInstances.count > 0)
+            renderQueue.submit(cubesCommand, viewDepth(view, cubePos));
+        if (!visibleRoses.empty())
+            renderQueue.submit(rosesCommand, viewDepth(view, rosePos));
+        renderQueue.submit(skyboxCommand, 0.0f);
+        renderQueue.flush();
+
+
+        // the spotlight comes on while a rose is in the crosshair
+        spotLightOn = programState->gameStart && aimedRose() >= 0;
+
         if (programState->ImGuiEnabled) {
+            TRACE_SCOPE("DrawImGui");
             DrawImGui(programState);
         }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
+        {
+            TRACE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
+        tracer().frameDone();
         glfwPollEvents();
     }
+    tracer().write();
     glDeleteVertexArrays(1, &skyboxVAO);
     glDeleteBuffers(1, &skyboxVBO);
 
     glDeleteVertexArrays(1, &cubeVAO);
     glDeleteBuffers(1, &cubeVBO);
+    glDeleteBuffers(1, &cubeInstances.VBO);
+
+    glDeleteBuffers(1, &flagInstances.VBO);
+    glDeleteBuffers(1, &flagLayerVBO);
+
+    uploadThread().stop();
 
     programState->SaveToFile("resources/program_state.txt");
     delete programState;
@@ -761,21 +969,15 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 
     if(key == GLFW_KEY_SPACE && action == GLFW_PRESS && programState->gameStart) {
 
-        double xpos = programState->camera.Front.x;
-        double ypos = programState->camera.Front.y;
-        double zpos = programState->camera.Front.z;
-        double zoom = programState->camera.Zoom;
-
-        if ((xpos + 0.128)*(xpos + 0.128) + (ypos + 0.064)*(ypos + 0.064) + (zpos + 0.989)*(zpos + 0.989) < 0.002
-            && zoom <= 7 && zoom >= 3) {
+        // the rose in the crosshair is collected
+        int rose = aimedRose();
+        if (rose == 0) {
             programState->rose1Collected = true;
         }
-        else if ((xpos - 0.208)*(xpos - 0.208) + (ypos - 0.099)*(ypos - 0.099) + (zpos + 0.972)*(zpos + 0.972) < 0.002
-                 && zoom <= 8 && zoom >= 3) {
+        else if (rose == 2) {
             programState->rose3Collected = true;
         }
-        else if ((xpos - 0.66)*(xpos - 0.66) + (ypos + 0.226)*(ypos + 0.226) + (zpos + 0.715)*(zpos + 0.715) < 0.002
-                 && zoom <= 7 && zoom >= 3) {
+        else if (rose == 1) {
             programState->rose2Collected = true;
         }
     }
@@ -785,77 +987,51 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     }
 }
 
-unsigned int loadCubemap(vector<std::string> faces)
+// the rose the camera is aimed at (its index in rosePos), -1 if none. A ray along the view direction is picked
+// against the roses in the scene BVH, and the view has to be zoomed in enough.
+int aimedRose()
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrComponents;
-    for (unsigned int i = 0; i < faces.size(); i++)
-    {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
-        else
-        {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    return textureID;
+    const float maxZoom[] = {7.0f, 7.0f, 8.0f};
+    float distance = 100.0f;
+    int object = sceneBvh.raycast(programState->camera.Position, programState->camera.Front, distance,
+                                  [](unsigned int object) { return object >= firstRoseObject; });
+    if (object < 0)
+        return -1;
+    int rose = object - firstRoseObject;
+    float zoom = programState->camera.Zoom;
+    if (zoom < 3.0f || zoom > maxZoom[rose])
+        return -1;
+    return rose;
 }
 
-unsigned int loadTexture(char const * path)
+// the loaders below go through the shared TextureCache and only queue the decode, see textureLoader().pump()/finish()
+TextureHandle loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    TRACE_SCOPE_DETAIL("loadCubemap", faces.empty() ? "" : faces[0].c_str());
+    return textureCache().loadCubemap(faces);
+}
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
+TextureHandle loadTextureArray(vector<std::string> layers)
+{
+    TRACE_SCOPE_DETAIL("loadTextureArray", layers.empty() ? "" : layers[0].c_str());
+    return textureCache().loadArray(layers);
+}
 
-    return textureID;
+TextureHandle loadTexture(char const * path)
+{
+    TRACE_SCOPE_DETAIL("loadTexture", path);
+    return textureCache().load2D(path);
 }
 
 void setShader(Shader ourShader, DirLight dirLight, PointLight pointLight, SpotLight spotLight) {
 
     ourShader.use();
 
+    // plain draws unless a pass says otherwise, the layer sampler keeps a unit of its own
+    ourShader.setBool("instanced", false);
+    ourShader.setBool("layered", false);
+    ourShader.setInt("material.texture_layers", FLAG_TEXTURE_UNIT);
+
     ourShader.setVec3("dirLight.direction", dirLight.direction);
     ourShader.setVec3("dirLight.ambient", dirLight.ambient);
     ourShader.setVec3("dirLight.diffuse", dirLight.diffuse);
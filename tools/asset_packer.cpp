@@ -0,0 +1,79 @@
+// Offline asset packer: writes every file under the given directories into one asset pack, which the
+// program maps at startup and reads shaders, textures and models from (see asset_pack.h).
+// Files are named relative to the directory of the pack, so build it where the program runs from:
+//
+//   asset_packer resources.pack resources
+//
+// Bake textures (texture_baker) and run the program once (for the .meshcache files) before packing,
+// so those end up in the pack too. Rerun it whenever an asset changes; packed files win over loose ones.
+
+#include <learnopengl/asset_pack.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+static bool endsWith(const string &value, const string &suffix)
+{
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// all regular files below path, leftovers of interrupted writes and other packs skipped
+static void collectFiles(const string &path, vector<string> &files)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        cout << "Skipping " << path << ", it doesn't exist" << endl;
+        return;
+    }
+    if (S_ISREG(info.st_mode))
+    {
+        if (!endsWith(path, ".tmp") && !endsWith(path, ".pack"))
+            files.push_back(path);
+        return;
+    }
+    if (!S_ISDIR(info.st_mode))
+        return;
+
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+        return;
+    while (dirent *entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if (name != "." && name != "..")
+            collectFiles(path + '/' + name, files);
+    }
+    closedir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        cout << "usage: " << argv[0] << " <pack> <file or directory>..." << endl;
+        return 1;
+    }
+    string packPath = argv[1];
+    string root = normalizeAssetPath(packPath);
+    root = root.substr(0, root.find_last_of('/') + 1);
+
+    vector<string> files;
+    for (int i = 2; i < argc; i++)
+        collectFiles(argv[i], files);
+
+    if (!writeAssetPack(packPath, root, files))
+    {
+        cout << "Failed to write " << packPath << endl;
+        return 1;
+    }
+
+    MappedFile pack(packPath);
+    cout << packPath << ": " << files.size() << " files, " << pack.size() / 1024 << " KB" << endl;
+    return 0;
+}
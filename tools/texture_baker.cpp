@@ -0,0 +1,78 @@
+// Offline texture baker: compresses images into block-compressed KTX2 files with a full mip chain.
+// Each <image> is written to <image>.ktx2 next to it, which is where the texture loader looks for it.
+//
+//   texture_baker resources/textures/box.png resources/textures/flags/*.png resources/textures/skybox/*1.png
+//
+// Opaque images become BC1, images with any alpha below 255 become BC3. Mips are filtered in linear light,
+// pass --linear before images that hold data rather than colors (specular, normal maps).
+
+#include <stb_image.h>
+
+#include <learnopengl/block_compress.h>
+#include <learnopengl/ktx2.h>
+#include <learnopengl/mipmap.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+static bool bake(const string &path, bool srgb)
+{
+    int width, height, nrComponents;
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrComponents, 4);
+    if (!data)
+    {
+        cout << "Texture failed to load at path: " << path << endl;
+        return false;
+    }
+
+    vector<MipLevel> levels(1);
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].pixels.assign(data, data + (size_t)width * height * 4);
+    stbi_image_free(data);
+    buildMipChain(levels, 4, srgb);
+
+    bool withAlpha = false;
+    for (size_t i = 3; i < levels[0].pixels.size() && !withAlpha; i += 4)
+        withAlpha = levels[0].pixels[i] != 255;
+
+    vector<vector<unsigned char>> compressed;
+    for (const MipLevel &level : levels)
+        compressed.push_back(compressImage(level.pixels.data(), level.width, level.height, withAlpha));
+
+    uint32_t vkFormat = withAlpha ? KTX2_FORMAT_BC3_UNORM : KTX2_FORMAT_BC1_RGB_UNORM;
+    string outPath = path + ".ktx2";
+    if (!writeKtx2(outPath, vkFormat, width, height, compressed))
+    {
+        cout << "Failed to write " << outPath << endl;
+        return false;
+    }
+
+    size_t bytes = 0;
+    for (const vector<unsigned char> &level : compressed)
+        bytes += level.size();
+    cout << outPath << ": " << width << "x" << height << ", " << levels.size() << " levels, "
+         << (withAlpha ? "BC3" : "BC1") << ", " << bytes / 1024 << " KB" << endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        cout << "usage: " << argv[0] << " [--linear] <image>..." << endl;
+        return 1;
+    }
+    int failed = 0;
+    bool srgb = true;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--linear")
+            srgb = false;
+        else if (!bake(argv[i], srgb))
+            failed++;
+    }
+    return failed == 0 ? 0 : 1;
+}